@@ -0,0 +1,512 @@
+#include "shell.h"
+
+/*
+ * Arithmetic expansion $((...)).
+ *
+ * Expression is parsed by precedence climbing into a tree, whose nodes are
+ * kept in a single array, and evaluated over 64-bit integers that wrap around
+ * on overflow. Supported are C operators without pointers, i.e. unary + - ! ~,
+ * pre- and post- increment and decrement, binary arithmetic, shift, relational
+ * bitwise and logical operators, conditional operator, assignment operators and
+ * comma, as well as exponentiation **. Variables are referred to by bare names
+ * and unset or empty ones have value of zero.
+ *
+ * Parsed expressions are cached by their text, so an expression in a body of
+ * a loop or function is parsed only once. Expressions that contain parameters
+ * (i.e. "$x") are parsed after expansion and are not cached, as their text
+ * changes with each evaluation.
+ */
+
+enum {
+  A_NUM,     /* integer literal */
+  A_VAR,     /* variable */
+  A_NEG,     /* unary minus */
+  A_NOT,     /* logical negation */
+  A_COMPL,   /* bitwise complement */
+  A_PREINC,  /* ++var */
+  A_PREDEC,  /* --var */
+  A_POSTINC, /* var++ */
+  A_POSTDEC, /* var-- */
+  A_ASSIGN,  /* var = right, or var op= right */
+  A_COND,    /* left ? right : alt */
+  A_COMMA,   /* left , right */
+  /* binary operators */
+  A_OR, A_AND, A_BOR, A_XOR, A_BAND, A_EQ, A_NE, A_LT, A_LE, A_GT, A_GE,
+  A_SHL, A_SHR, A_ADD, A_SUB, A_MUL, A_DIV, A_MOD, A_POW,
+};
+
+/* Two character operators must precede their one character prefixes. */
+static const struct {
+  const char *str;
+  int op;
+  int prec;
+} binops[] = {
+  {"||", A_OR, 1},  {"&&", A_AND, 2}, {"==", A_EQ, 6},  {"!=", A_NE, 6},
+  {"<=", A_LE, 7},  {">=", A_GE, 7},  {"<<", A_SHL, 8}, {">>", A_SHR, 8},
+  {"**", A_POW, 11},
+  {"|", A_BOR, 3},  {"^", A_XOR, 4},  {"&", A_BAND, 5}, {"<", A_LT, 7},
+  {">", A_GT, 7},   {"+", A_ADD, 9},  {"-", A_SUB, 9},  {"*", A_MUL, 10},
+  {"/", A_DIV, 10}, {"%", A_MOD, 10}, {NULL, 0, 0},
+};
+
+typedef struct {
+  int type;
+  int op;               /* A_ASSIGN: binary operator or A_ASSIGN */
+  int left, right, alt; /* indices of operands */
+  int64_t num;          /* A_NUM: value */
+  const char *name;     /* A_VAR: name in text of expression */
+  size_t namelen;       /* A_VAR: length of name */
+} anode_t;
+
+typedef struct aexpr {
+  struct aexpr *next; /* next expression in hash chain */
+  uint32_t hash;      /* hash of expression text */
+  char *text;         /* expression text */
+  anode_t *node;      /* nodes of expression tree */
+  int nnodes;         /* number of nodes */
+  int root;           /* index of root node */
+} aexpr_t;
+
+typedef struct {
+  aexpr_t *e;         /* expression being built */
+  int maxnodes;       /* capacity of node array */
+  const char *s;      /* current position in text */
+  const char *error;  /* description of the first error */
+} aparser_t;
+
+#define NBUCKETS 64
+#define MAXCACHED 256 /* cache is flushed when it grows larger */
+
+static aexpr_t *cache[NBUCKETS];
+static int ncached = 0;
+
+static int mknode(aparser_t *p, int type, int left, int right) {
+  aexpr_t *e = p->e;
+  if (e->nnodes == p->maxnodes) {
+    p->maxnodes = p->maxnodes ? p->maxnodes * 2 : 8;
+    e->node = Realloc(e->node, sizeof(anode_t) * p->maxnodes);
+  }
+  e->node[e->nnodes] = (anode_t){
+    .type = type, .left = left, .right = right, .alt = -1};
+  return e->nnodes++;
+}
+
+static int varnode(aparser_t *p, size_t len) {
+  int n = mknode(p, A_VAR, -1, -1);
+  p->e->node[n].name = p->s;
+  p->e->node[n].namelen = len;
+  p->s += len;
+  return n;
+}
+
+static int error(aparser_t *p, const char *what) {
+  if (p->error == NULL)
+    p->error = what;
+  return -1;
+}
+
+static void skip(aparser_t *p) {
+  while (isspace(*p->s))
+    p->s++;
+}
+
+/* Returns index of binary operator at `s` or -1 if there's none. */
+static int binop(const char *s) {
+  for (int i = 0; binops[i].str; i++)
+    if (!strncmp(s, binops[i].str, strlen(binops[i].str)))
+      return i;
+  return -1;
+}
+
+/* Returns operator of assignment at `s` and sets its length, or -1. */
+static int assignop(const char *s, size_t *lenp) {
+  if (s[0] == '=' && s[1] != '=') {
+    *lenp = 1;
+    return A_ASSIGN;
+  }
+
+  int i = binop(s);
+  if (i < 0)
+    return -1;
+
+  int op = binops[i].op;
+  size_t len = strlen(binops[i].str);
+  if (s[len] != '=' || op == A_OR || op == A_AND || (op >= A_EQ && op <= A_GE))
+    return -1;
+  *lenp = len + 1;
+  return op;
+}
+
+static int comma(aparser_t *p);
+
+static int primary(aparser_t *p) {
+  skip(p);
+
+  if (*p->s == '(') {
+    p->s++;
+    int n = comma(p);
+    if (n < 0)
+      return -1;
+    skip(p);
+    if (*p->s != ')')
+      return error(p, "missing ')'");
+    p->s++;
+    return n;
+  }
+
+  if (isdigit(*p->s)) {
+    char *end;
+    errno = 0;
+    uint64_t value = strtoull(p->s, &end, 0);
+    if (errno || isalnum(*end) || *end == '_')
+      return error(p, "invalid number");
+    p->s = end;
+    int n = mknode(p, A_NUM, -1, -1);
+    p->e->node[n].num = (int64_t)value;
+    return n;
+  }
+
+  size_t len = varnamelen(p->s);
+  if (len == 0)
+    return error(p, *p->s ? "syntax error" : "operand expected");
+
+  int n = varnode(p, len);
+  skip(p);
+  if ((p->s[0] == '+' || p->s[0] == '-') && p->s[1] == p->s[0]) {
+    n = mknode(p, p->s[0] == '+' ? A_POSTINC : A_POSTDEC, n, -1);
+    p->s += 2;
+  }
+  return n;
+}
+
+static int unary(aparser_t *p) {
+  skip(p);
+
+  char c = *p->s;
+
+  if ((c == '+' || c == '-') && p->s[1] == c) {
+    p->s += 2;
+    skip(p);
+    size_t len = varnamelen(p->s);
+    if (len == 0)
+      return error(p, "variable expected");
+    return mknode(p, c == '+' ? A_PREINC : A_PREDEC, varnode(p, len), -1);
+  }
+
+  if (c == '+' || c == '-' || c == '!' || c == '~') {
+    p->s++;
+    int n = unary(p);
+    if (n < 0 || c == '+')
+      return n;
+    return mknode(p, c == '-' ? A_NEG : c == '!' ? A_NOT : A_COMPL, n, -1);
+  }
+
+  return primary(p);
+}
+
+/* Parse operands joined with binary operators of at least given precedence. */
+static int binary(aparser_t *p, int minprec) {
+  int left = unary(p);
+
+  while (left >= 0) {
+    skip(p);
+    int i = binop(p->s);
+    size_t len;
+    /* Stop at compound assignment, which is not a binary operator. */
+    if (i < 0 || binops[i].prec < minprec || assignop(p->s, &len) >= 0)
+      break;
+    p->s += strlen(binops[i].str);
+    /* Exponentiation is right associative. */
+    int prec = binops[i].prec + (binops[i].op != A_POW);
+    int right = binary(p, prec);
+    if (right < 0)
+      return -1;
+    left = mknode(p, binops[i].op, left, right);
+  }
+
+  return left;
+}
+
+static int conditional(aparser_t *p) {
+  int n = binary(p, 1);
+  skip(p);
+  if (n < 0 || *p->s != '?')
+    return n;
+  p->s++;
+
+  int right = comma(p);
+  if (right < 0)
+    return -1;
+  skip(p);
+  if (*p->s != ':')
+    return error(p, "':' expected");
+  p->s++;
+
+  int alt = conditional(p);
+  if (alt < 0)
+    return -1;
+
+  n = mknode(p, A_COND, n, right);
+  p->e->node[n].alt = alt;
+  return n;
+}
+
+static int assignment(aparser_t *p) {
+  skip(p);
+
+  size_t len = varnamelen(p->s);
+  if (len > 0) {
+    const char *s = p->s + len;
+    while (isspace(*s))
+      s++;
+    size_t oplen;
+    int op = assignop(s, &oplen);
+    if (op >= 0) {
+      int var = varnode(p, len);
+      p->s = s + oplen;
+      int value = assignment(p);
+      if (value < 0)
+        return -1;
+      int n = mknode(p, A_ASSIGN, var, value);
+      p->e->node[n].op = op;
+      return n;
+    }
+  }
+
+  return conditional(p);
+}
+
+static int comma(aparser_t *p) {
+  int n = assignment(p);
+
+  while (n >= 0) {
+    skip(p);
+    if (*p->s != ',')
+      break;
+    p->s++;
+    int right = assignment(p);
+    if (right < 0)
+      return -1;
+    n = mknode(p, A_COMMA, n, right);
+  }
+
+  return n;
+}
+
+static bool parse_expr(aexpr_t *e) {
+  aparser_t p = {.e = e, .s = e->text};
+
+  skip(&p);
+  if (*p.s == '\0') {
+    e->root = mknode(&p, A_NUM, -1, -1); /* empty expression is zero */
+    return true;
+  }
+
+  e->root = comma(&p);
+  if (e->root >= 0 && *p.s != '\0')
+    e->root = error(&p, "syntax error");
+  if (e->root < 0) {
+    msg("%s: %s (error token is \"%s\")\n", e->text, p.error, p.s);
+    return false;
+  }
+  return true;
+}
+
+static void free_expr(aexpr_t *e) {
+  free(e->text);
+  free(e->node);
+  free(e);
+}
+
+static bool getnum(aexpr_t *e, anode_t *n, int64_t *valuep) {
+  const char *value = getvar(n->name, n->namelen);
+
+  if (value == NULL || *value == '\0') {
+    *valuep = 0;
+    return true;
+  }
+
+  char *end;
+  errno = 0;
+  *valuep = strtoll(value, &end, 0);
+  while (isspace(*end))
+    end++;
+  if (errno || *end != '\0' || end == value) {
+    msg("%s: %.*s: invalid number '%s'\n", e->text, (int)n->namelen, n->name,
+        value);
+    return false;
+  }
+  return true;
+}
+
+static void setnum(anode_t *n, int64_t value) {
+  char *assignment = Malloc(n->namelen + 24);
+  snprintf(assignment, n->namelen + 24, "%.*s=%lld", (int)n->namelen, n->name,
+           (long long)value);
+  setvar(assignment, false);
+  free(assignment);
+}
+
+/* Apply binary operator. Arithmetic is done on unsigned integers, since
+ * signed overflow is undefined in C. */
+static bool calc(aexpr_t *e, int op, int64_t a, int64_t b, int64_t *valuep) {
+  uint64_t ua = a, ub = b;
+
+  switch (op) {
+    case A_BOR: *valuep = a | b; break;
+    case A_XOR: *valuep = a ^ b; break;
+    case A_BAND: *valuep = a & b; break;
+    case A_EQ: *valuep = a == b; break;
+    case A_NE: *valuep = a != b; break;
+    case A_LT: *valuep = a < b; break;
+    case A_LE: *valuep = a <= b; break;
+    case A_GT: *valuep = a > b; break;
+    case A_GE: *valuep = a >= b; break;
+    case A_SHL: *valuep = ua << (b & 63); break;
+    case A_SHR: *valuep = a >> (b & 63); break;
+    case A_ADD: *valuep = ua + ub; break;
+    case A_SUB: *valuep = ua - ub; break;
+    case A_MUL: *valuep = ua * ub; break;
+    case A_DIV:
+    case A_MOD:
+      if (b == 0) {
+        msg("%s: division by zero\n", e->text);
+        return false;
+      }
+      if (a == INT64_MIN && b == -1)
+        *valuep = (op == A_DIV) ? a : 0;
+      else
+        *valuep = (op == A_DIV) ? a / b : a % b;
+      break;
+    case A_POW:
+      if (b < 0) {
+        msg("%s: exponent less than 0\n", e->text);
+        return false;
+      }
+      for (*valuep = 1; b > 0; b >>= 1, ua *= ua)
+        if (b & 1)
+          *valuep = (uint64_t)*valuep * ua;
+      break;
+  }
+
+  return true;
+}
+
+static bool eval(aexpr_t *e, int i, int64_t *valuep) {
+  anode_t *n = &e->node[i];
+  anode_t *var = (n->left >= 0) ? &e->node[n->left] : NULL;
+  int64_t a, b;
+
+  switch (n->type) {
+    case A_NUM:
+      *valuep = n->num;
+      return true;
+
+    case A_VAR:
+      return getnum(e, n, valuep);
+
+    case A_NEG:
+    case A_NOT:
+    case A_COMPL:
+      if (!eval(e, n->left, &a))
+        return false;
+      *valuep = (n->type == A_NEG) ? (int64_t)-(uint64_t)a
+                : (n->type == A_NOT) ? !a : ~a;
+      return true;
+
+    case A_PREINC:
+    case A_PREDEC:
+    case A_POSTINC:
+    case A_POSTDEC:
+      if (!getnum(e, var, &a))
+        return false;
+      b = (n->type == A_PREINC || n->type == A_POSTINC) ? (uint64_t)a + 1
+                                                        : (uint64_t)a - 1;
+      setnum(var, b);
+      *valuep = (n->type == A_PREINC || n->type == A_PREDEC) ? b : a;
+      return true;
+
+    case A_ASSIGN:
+      if (!eval(e, n->right, &b))
+        return false;
+      if (n->op != A_ASSIGN)
+        if (!getnum(e, var, &a) || !calc(e, n->op, a, b, &b))
+          return false;
+      setnum(var, b);
+      *valuep = b;
+      return true;
+
+    case A_COND:
+      if (!eval(e, n->left, &a))
+        return false;
+      return eval(e, a ? n->right : n->alt, valuep);
+
+    case A_COMMA:
+      return eval(e, n->left, &a) && eval(e, n->right, valuep);
+
+    case A_AND:
+    case A_OR:
+      if (!eval(e, n->left, &a))
+        return false;
+      if ((n->type == A_AND) != (a != 0)) {
+        *valuep = (a != 0);
+        return true;
+      }
+      if (!eval(e, n->right, &b))
+        return false;
+      *valuep = (b != 0);
+      return true;
+
+    default:
+      if (!eval(e, n->left, &a) || !eval(e, n->right, &b))
+        return false;
+      return calc(e, n->type, a, b, valuep);
+  }
+}
+
+static void flush_cache(void) {
+  for (int i = 0; i < NBUCKETS; i++) {
+    while (cache[i]) {
+      aexpr_t *e = cache[i];
+      cache[i] = e->next;
+      free_expr(e);
+    }
+  }
+  ncached = 0;
+}
+
+/* Evaluate arithmetic expression. Parsed expression is remembered if `cached`
+ * is set. Returns false and reports an error if expression is malformed or
+ * cannot be evaluated. */
+bool arith(const char *expr, bool cached, int64_t *valuep) {
+  aexpr_t *e = NULL;
+  uint32_t hash = 0;
+
+  if (cached) {
+    hash = jenkins_strhash(expr, strlen(expr));
+    for (e = cache[hash % NBUCKETS]; e; e = e->next)
+      if (e->hash == hash && !strcmp(e->text, expr))
+        break;
+  }
+
+  if (e == NULL) {
+    e = Malloc(sizeof(aexpr_t));
+    *e = (aexpr_t){.hash = hash, .text = strdup(expr)};
+    if (!parse_expr(e)) {
+      free_expr(e);
+      return false;
+    }
+    if (cached) {
+      if (ncached == MAXCACHED)
+        flush_cache();
+      e->next = cache[hash % NBUCKETS];
+      cache[hash % NBUCKETS] = e;
+      ncached++;
+    }
+  }
+
+  bool ok = eval(e, e->root, valuep);
+  if (!cached)
+    free_expr(e);
+  return ok;
+}
@@ -0,0 +1,459 @@
+#include "shell.h"
+
+/*
+ * Brace expansion: "a{b,c}d" yields "abd" and "acd", "{1..10..3}" yields
+ * "1", "4", "7" and "10", and "{a..e}" yields consecutive letters. Braces
+ * within quotes, "${...}", "$(...)" and "$((...))" are not expanded here.
+ *
+ * A word is parsed into a tree once and the resulting words are generated one
+ * at a time by an iterator that works like an odometer: the rightmost brace
+ * expression changes fastest. Hence a consumer can go through a sequence of
+ * millions of words using constant memory. Number of words and their total
+ * length are computed from the tree without generating them, so that the shell
+ * can refuse an expansion that does not fit into argv before allocating it.
+ */
+
+enum {
+  B_TEXT,  /* literal text */
+  B_ALT,   /* comma separated alternatives */
+  B_RANGE, /* sequence of numbers or characters */
+};
+
+typedef struct bnode {
+  int kind;
+  struct bnode *next; /* next item of a sequence */
+  /* B_TEXT */
+  const char *text;
+  size_t len;
+  /* B_ALT: each alternative is a sequence, NULL if it's empty */
+  struct bnode **alts;
+  int nalts;
+  int alt; /* current alternative */
+  /* B_RANGE */
+  long first, step; /* first element and signed increment */
+  uint64_t count;   /* number of elements */
+  uint64_t k;       /* index of current element */
+  int width;        /* minimum width of zero padded numbers */
+  bool chars;       /* elements are characters rather than numbers */
+} bnode_t;
+
+struct brace {
+  char *word;   /* copy of the word that nodes refer to */
+  bnode_t *seq; /* top level sequence */
+  bool started; /* first word was generated */
+  char *buf;    /* current word */
+  size_t size;  /* capacity of buf */
+};
+
+static bnode_t *mkbnode(int kind) {
+  bnode_t *n = Calloc(1, sizeof(bnode_t));
+  n->kind = kind;
+  return n;
+}
+
+static void freeseq(bnode_t *n) {
+  while (n) {
+    bnode_t *next = n->next;
+    for (int i = 0; i < n->nalts; i++)
+      freeseq(n->alts[i]);
+    free(n->alts);
+    free(n);
+    n = next;
+  }
+}
+
+/* Returns end of quoted text, command substitution or arithmetic expansion
+ * that starts at `s`, or NULL if there is none. Braces within are left to
+ * whoever expands them. */
+static const char *skipregion(const char *s, const char *end) {
+  if (*s == '\'' || *s == '"') {
+    for (const char *q = s + 1; q < end; q++) {
+      if (*q == '\\' && *s == '"' && q + 1 < end)
+        q++;
+      else if (*q == *s)
+        return q + 1;
+    }
+    return NULL;
+  }
+
+  if (*s == '$' && s + 1 < end && s[1] == '(') {
+    int depth = 0;
+    for (const char *p = s + 1; p < end; p++) {
+      if (*p == '\\' && p + 1 < end)
+        p++;
+      else if (*p == '(')
+        depth++;
+      else if (*p == ')' && --depth == 0)
+        return p + 1;
+    }
+  }
+
+  return NULL;
+}
+
+/* Returns matching closing brace for the one at `s` or NULL.
+ * Sets `*commap` if there's a comma at top level within the braces. */
+static const char *findclose(const char *s, const char *end, bool *commap) {
+  int depth = 0;
+
+  *commap = false;
+
+  for (const char *r; s < end; s++) {
+    if (*s == '\\' && s + 1 < end) {
+      s++;
+    } else if ((r = skipregion(s, end))) {
+      s = r - 1;
+    } else if (*s == '{') {
+      depth++;
+    } else if (*s == '}') {
+      if (--depth == 0)
+        return s;
+    } else if (*s == ',' && depth == 1) {
+      *commap = true;
+    }
+  }
+
+  return NULL;
+}
+
+static bool parsenum(const char *s, const char *end, long *np) {
+  char buf[32];
+  char *e;
+
+  if (end - s == 0 || end - s >= (long)sizeof(buf))
+    return false;
+  memcpy(buf, s, end - s);
+  buf[end - s] = '\0';
+  errno = 0;
+  *np = strtol(buf, &e, 10);
+  return *e == '\0' && errno == 0;
+}
+
+static int numwidth(const char *s, const char *end) {
+  const char *d = (*s == '-') ? s + 1 : s;
+  /* Leading zero requests padding to the width of the longer endpoint. */
+  return (end - d > 1 && *d == '0') ? end - s : 0;
+}
+
+/* Try to parse "x..y" or "x..y..incr" that is found between `s` and `end`. */
+static bnode_t *parserange(const char *s, const char *end) {
+  const char *dots = strstr(s, "..");
+  if (dots == NULL || dots >= end)
+    return NULL;
+
+  const char *y = dots + 2;
+  const char *yend = strstr(y, "..");
+  long incr = 1;
+
+  if (yend == NULL || yend >= end) {
+    yend = end;
+  } else if (!parsenum(yend + 2, end, &incr)) {
+    return NULL;
+  }
+
+  long from, to;
+  int width = 0;
+  bool chars = false;
+
+  if (dots - s == 1 && yend - y == 1 && isalpha(*s) && isalpha(*y)) {
+    from = *s;
+    to = *y;
+    chars = true;
+  } else if (parsenum(s, dots, &from) && parsenum(y, yend, &to)) {
+    width = max(numwidth(s, dots), numwidth(y, yend));
+  } else {
+    return NULL;
+  }
+
+  /* Direction is determined by the endpoints, not by sign of increment. */
+  uint64_t step = (incr < 0) ? -(uint64_t)incr : (uint64_t)incr;
+  if (step == 0)
+    step = 1;
+  uint64_t dist = (from <= to) ? (uint64_t)to - from : (uint64_t)from - to;
+
+  bnode_t *n = mkbnode(B_RANGE);
+  n->first = from;
+  n->step = (from <= to) ? (long)step : -(long)step;
+  n->count = dist / step + 1;
+  n->width = width;
+  n->chars = chars;
+  return n;
+}
+
+/* Parse text between `s` and `end` into a sequence of nodes. */
+static bnode_t *parseseq(const char *s, const char *end) {
+  bnode_t *head = NULL, **tailp = &head;
+  const char *text = s;
+
+  while (s < end) {
+    if (*s == '\\' && s + 1 < end) {
+      s += 2;
+      continue;
+    }
+
+    const char *skip = skipregion(s, end);
+    if (skip) {
+      s = skip;
+      continue;
+    }
+
+    /* "${" starts parameter expansion rather than brace expansion. */
+    bool comma;
+    const char *close;
+    if (*s != '{' || (s > text && s[-1] == '$') ||
+        !(close = findclose(s, end, &comma))) {
+      s++;
+      continue;
+    }
+
+    bnode_t *n = NULL;
+
+    if (comma) {
+      n = mkbnode(B_ALT);
+      for (const char *alt = s + 1;;) {
+        const char *sep = alt, *r;
+        int depth = 0;
+        for (; sep < close && (depth > 0 || *sep != ','); sep++) {
+          if (*sep == '\\' && sep + 1 < close)
+            sep++;
+          else if ((r = skipregion(sep, close)))
+            sep = r - 1;
+          else if (*sep == '{')
+            depth++;
+          else if (*sep == '}')
+            depth--;
+        }
+        n->alts = Realloc(n->alts, sizeof(bnode_t *) * (n->nalts + 1));
+        n->alts[n->nalts++] = parseseq(alt, sep);
+        if (sep == close)
+          break;
+        alt = sep + 1;
+      }
+    } else if (!(n = parserange(s + 1, close))) {
+      s++;
+      continue;
+    }
+
+    if (s > text) {
+      bnode_t *t = mkbnode(B_TEXT);
+      t->text = text;
+      t->len = s - text;
+      *tailp = t;
+      tailp = &t->next;
+    }
+
+    *tailp = n;
+    tailp = &n->next;
+    s = text = close + 1;
+  }
+
+  if (s > text) {
+    bnode_t *t = mkbnode(B_TEXT);
+    t->text = text;
+    t->len = s - text;
+    *tailp = t;
+  }
+
+  return head;
+}
+
+static inline uint64_t satadd(uint64_t a, uint64_t b) {
+  uint64_t r;
+  return __builtin_add_overflow(a, b, &r) ? UINT64_MAX : r;
+}
+
+static inline uint64_t satmul(uint64_t a, uint64_t b) {
+  uint64_t r;
+  return __builtin_mul_overflow(a, b, &r) ? UINT64_MAX : r;
+}
+
+/* Count elements of progression lo + k * step, for k in [0, count), that
+ * fall between `a` and `b` inclusive. */
+static uint64_t inrange(long lo, uint64_t step, uint64_t count, long a,
+                        long b) {
+  if (b < lo)
+    return 0;
+  uint64_t kmin = (a <= lo) ? 0 : ((uint64_t)a - lo + step - 1) / step;
+  uint64_t kmax = ((uint64_t)b - lo) / step;
+  if (kmax >= count)
+    kmax = count - 1;
+  return (kmin <= kmax) ? kmax - kmin + 1 : 0;
+}
+
+/* Total length of numbers in range. Elements are grouped by number of digits,
+ * so the cost does not depend on the number of elements. */
+static uint64_t rangelen(bnode_t *n) {
+  if (n->chars)
+    return n->count;
+
+  /* Go through the progression in ascending order. */
+  uint64_t step = (n->step < 0) ? -(uint64_t)n->step : (uint64_t)n->step;
+  long lo = n->first;
+  if (n->step < 0)
+    lo += n->step * (long)(n->count - 1);
+  uint64_t total = 0;
+
+  long from = 0, to = 9;
+  for (int digits = 1; digits <= 19; digits++) {
+    uint64_t pos = inrange(lo, step, n->count, from, to);
+    uint64_t neg = inrange(lo, step, n->count, -to, -from - (from == 0));
+    total = satadd(total, satmul(pos, max(digits, n->width)));
+    total = satadd(total, satmul(neg, max(digits + 1, n->width)));
+    if (to == LONG_MAX)
+      break;
+    from = to + 1;
+    to = (to > LONG_MAX / 10) ? LONG_MAX : to * 10 + 9;
+  }
+
+  return total;
+}
+
+/* Compute number of words generated by a sequence and their total length. */
+static void measure(bnode_t *seq, uint64_t *countp, uint64_t *lenp) {
+  uint64_t count = 1, len = 0;
+
+  for (bnode_t *n = seq; n; n = n->next) {
+    uint64_t c = 0, l = 0;
+
+    if (n->kind == B_TEXT) {
+      c = 1;
+      l = n->len;
+    } else if (n->kind == B_ALT) {
+      for (int i = 0; i < n->nalts; i++) {
+        uint64_t ac, al;
+        measure(n->alts[i], &ac, &al);
+        c = satadd(c, ac);
+        l = satadd(l, al);
+      }
+    } else {
+      c = n->count;
+      l = rangelen(n);
+    }
+
+    /* Each word of this item is combined with every word of the others. */
+    len = satadd(satmul(len, c), satmul(l, count));
+    count = satmul(count, c);
+  }
+
+  *countp = count;
+  *lenp = len;
+}
+
+static void reset(bnode_t *seq) {
+  for (bnode_t *n = seq; n; n = n->next) {
+    n->alt = 0;
+    n->k = 0;
+    for (int i = 0; i < n->nalts; i++)
+      reset(n->alts[i]);
+  }
+}
+
+static bool advanceseq(bnode_t *seq);
+
+/* Move item to its next value. Returns false if it wrapped around. */
+static bool advance(bnode_t *n) {
+  if (n->kind == B_ALT) {
+    if (advanceseq(n->alts[n->alt]))
+      return true;
+    if (++n->alt < n->nalts)
+      return true;
+    n->alt = 0;
+    return false;
+  }
+
+  if (n->kind == B_RANGE) {
+    if (++n->k < n->count)
+      return true;
+    n->k = 0;
+    return false;
+  }
+
+  return false;
+}
+
+static bool advanceseq(bnode_t *seq) {
+  if (seq == NULL)
+    return false;
+  /* Rightmost item changes fastest. */
+  if (advanceseq(seq->next))
+    return true;
+  return advance(seq);
+}
+
+static void append(brace_t *b, size_t *lenp, const char *s, size_t n) {
+  if (*lenp + n + 1 > b->size) {
+    b->size = max(b->size * 2, *lenp + n + 1);
+    b->buf = Realloc(b->buf, b->size);
+  }
+  memcpy(b->buf + *lenp, s, n);
+  *lenp += n;
+}
+
+static void render(brace_t *b, size_t *lenp, bnode_t *seq) {
+  for (bnode_t *n = seq; n; n = n->next) {
+    if (n->kind == B_TEXT) {
+      append(b, lenp, n->text, n->len);
+    } else if (n->kind == B_ALT) {
+      render(b, lenp, n->alts[n->alt]);
+    } else {
+      char num[32];
+      long v = n->first + n->step * (long)n->k;
+      int len = n->chars ? snprintf(num, sizeof(num), "%c", (char)v)
+                         : snprintf(num, sizeof(num), "%0*ld", n->width, v);
+      append(b, lenp, num, len);
+    }
+  }
+}
+
+/* Returns an iterator over brace expansion of the word, or NULL if the word
+ * does not contain any brace expression. */
+brace_t *brace_open(const char *word) {
+  if (!strchr(word, '{'))
+    return NULL;
+
+  char *copy = strdup(word);
+  bnode_t *seq = parseseq(copy, copy + strlen(copy));
+
+  if (seq == NULL || (seq->kind == B_TEXT && seq->next == NULL)) {
+    freeseq(seq);
+    free(copy);
+    return NULL;
+  }
+
+  brace_t *b = Malloc(sizeof(brace_t));
+  *b = (brace_t){.word = copy, .seq = seq};
+  reset(seq);
+  return b;
+}
+
+/* Returns next word of expansion or NULL if there are no more. The word is
+ * valid until the next call. */
+const char *brace_next(brace_t *b) {
+  if (b->started && !advanceseq(b->seq))
+    return NULL;
+  b->started = true;
+
+  size_t len = 0;
+  render(b, &len, b->seq);
+  append(b, &len, "", 0);
+  b->buf[len] = '\0';
+  return b->buf;
+}
+
+/* Number of words in expansion and their total length without terminators.
+ * Both saturate at SIZE_MAX. */
+void brace_size(brace_t *b, size_t *countp, size_t *lenp) {
+  uint64_t count, len;
+  measure(b->seq, &count, &len);
+  *countp = (count > SIZE_MAX) ? SIZE_MAX : count;
+  *lenp = (len > SIZE_MAX) ? SIZE_MAX : len;
+}
+
+void brace_close(brace_t *b) {
+  if (b == NULL)
+    return;
+  freeseq(b->seq);
+  free(b->word);
+  free(b->buf);
+  free(b);
+}
@@ -1,12 +1,88 @@
+#include <stdarg.h>
+
 #include "shell.h"
+#include "rio.h"
 
 typedef int (*func_t)(char **argv);
 
-typedef struct {
+typedef struct command {
   const char *name;
   func_t func;
+  bool pure; /* does not change state of the shell */
 } command_t;
 
+/* Standard output of builtins is collected in a buffer and written out to
+ * a descriptor chosen by redirections when the command completes. */
+static struct {
+  int fd;                  /* descriptor to write the output to */
+  size_t len;              /* number of bytes buffered */
+  char buf[RIO_BUFSIZE]; /* pending output */
+} out;
+
+/* Output of builtins run by command substitution goes to memory instead. */
+static capture_t *capture = NULL;
+
+/* Append output to capture buffer or write it out to descriptor. */
+static void out_put(const char *s, size_t n) {
+  if (capture == NULL || out.fd >= 0) {
+    (void)rio_writen(out.fd, s, n);
+    return;
+  }
+
+  if (capture->len + n > capture->size) {
+    capture->size = max(capture->size * 2, capture->len + n);
+    capture->buf = Realloc(capture->buf, capture->size);
+  }
+  memcpy(capture->buf + capture->len, s, n);
+  capture->len += n;
+}
+
+static void out_flush(void) {
+  if (out.len > 0)
+    out_put(out.buf, out.len);
+  out.len = 0;
+}
+
+static void out_write(const char *s, size_t n) {
+  if (out.len + n > sizeof(out.buf))
+    out_flush();
+  if (n > sizeof(out.buf)) {
+    out_put(s, n);
+    return;
+  }
+  memcpy(out.buf + out.len, s, n);
+  out.len += n;
+}
+
+static inline void out_char(char c) {
+  out_write(&c, 1);
+}
+
+static __attribute__((format(printf, 1, 2))) void out_printf(const char *fmt,
+                                                             ...) {
+  va_list ap;
+  int n;
+
+  /* Try to format directly into the buffer, then into flushed buffer. */
+  for (int i = 0; i < 2; i++) {
+    va_start(ap, fmt);
+    n = vsnprintf(out.buf + out.len, sizeof(out.buf) - out.len, fmt, ap);
+    va_end(ap);
+    if (out.len + n < sizeof(out.buf)) {
+      out.len += n;
+      return;
+    }
+    out_flush();
+  }
+
+  char *s = Malloc(n + 1);
+  va_start(ap, fmt);
+  vsnprintf(s, n + 1, fmt, ap);
+  va_end(ap);
+  out_write(s, n);
+  free(s);
+}
+
 static int do_quit(char **argv) {
   shutdownjobs();
   exit(EXIT_SUCCESS);
@@ -91,26 +167,670 @@ static int do_kill(char **argv) {
   return 0;
 }
 
+/*
+ * Display commands from persistent history, the most recent one first.
+ * 'history' - list all commands
+ * 'history pattern' - list commands that contain pattern
+ */
+static int do_history(char **argv) {
+  const char *pattern = argv[0] ? argv[0] : "";
+  const char *cmd;
+
+  for (int e = -1; (cmd = hist_find(pattern, &e));)
+    out_printf("%5d  %s\n", e + 1, cmd);
+
+  return 0;
+}
+
+static int do_true(char **argv) {
+  return 0;
+}
+
+static int do_false(char **argv) {
+  return 1;
+}
+
+/* Decode escape sequence that follows a backslash. Stores the character in
+ * `*cp` and returns the number of characters consumed, or -1 for '\c' that
+ * suppresses further output. */
+static int unescape(const char *s, char *cp) {
+  static const char escapes[] = "\\\\a\ab\bf\fn\nr\rt\tv\v";
+
+  if (*s == 'c')
+    return -1;
+
+  if (*s >= '0' && *s <= '7') {
+    int n = (*s == '0') ? 1 : 0, c = 0;
+    for (int i = 0; i < 3 && s[n] >= '0' && s[n] <= '7'; i++, n++)
+      c = c * 8 + s[n] - '0';
+    *cp = c;
+    return n;
+  }
+
+  for (const char *e = escapes; *e; e += 2) {
+    if (*s == e[0]) {
+      *cp = e[1];
+      return 1;
+    }
+  }
+
+  /* Unknown sequence is printed as is. */
+  *cp = '\\';
+  return 0;
+}
+
+/* Write string interpreting escape sequences.
+ * Returns false if output should stop due to '\c'. */
+static bool out_escaped(const char *s) {
+  for (; *s; s++) {
+    if (*s != '\\' || s[1] == '\0') {
+      out_char(*s);
+      continue;
+    }
+    char c;
+    int n = unescape(s + 1, &c);
+    if (n < 0)
+      return false;
+    out_char(c);
+    s += n;
+  }
+  return true;
+}
+
+/*
+ * Write arguments separated by spaces to standard output.
+ * 'echo [-n] [-e] args...'
+ * -n - do not output the trailing newline
+ * -e - interpret backslash escapes
+ */
+static int do_echo(char **argv) {
+  bool newline = true, escapes = false;
+
+  for (; *argv && (*argv)[0] == '-' && (*argv)[1]; argv++) {
+    const char *opt = *argv + 1;
+    if (strspn(opt, "neE") != strlen(opt))
+      break;
+    for (; *opt; opt++) {
+      if (*opt == 'n')
+        newline = false;
+      else
+        escapes = (*opt == 'e');
+    }
+  }
+
+  for (; *argv; argv++) {
+    if (escapes) {
+      if (!out_escaped(*argv))
+        return 0;
+    } else {
+      out_write(*argv, strlen(*argv));
+    }
+    if (argv[1])
+      out_char(' ');
+  }
+
+  if (newline)
+    out_char('\n');
+  return 0;
+}
+
+/* Convert printf argument to a number. Leading quote yields character code. */
+static bool tonumber(const char *arg, long long *np) {
+  char *end;
+
+  if (arg == NULL || *arg == '\0') {
+    *np = 0;
+    return true;
+  }
+  if (arg[0] == '\'' || arg[0] == '"') {
+    *np = (unsigned char)arg[1];
+    return true;
+  }
+  errno = 0;
+  *np = strtoll(arg, &end, 0);
+  if (errno == ERANGE && arg[0] != '-')
+    *np = (long long)strtoull(arg, &end, 0);
+  if (*end || errno) {
+    msg("printf: %s: invalid number\n", arg);
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Write arguments formatted according to format.
+ * 'printf format [args...]'
+ * Format is reused as long as there are arguments left to consume.
+ */
+static int do_printf(char **argv) {
+  if (argv[0] == NULL) {
+    msg("printf: usage: printf format [arguments]\n");
+    return 2;
+  }
+
+  const char *format = *argv++;
+  int rc = 0;
+
+  do {
+    char **first = argv;
+
+    for (const char *p = format; *p; p++) {
+      if (*p == '\\' && p[1]) {
+        char c;
+        int n = unescape(p + 1, &c);
+        if (n < 0)
+          return rc;
+        out_char(c);
+        p += n;
+        continue;
+      }
+
+      if (*p != '%' || p[1] == '\0') {
+        out_char(*p);
+        continue;
+      }
+
+      if (*++p == '%') {
+        out_char('%');
+        continue;
+      }
+
+      /* Copy flags, field width and precision into format for snprintf. */
+      char spec[32] = "%";
+      size_t n = strspn(p, "-+ #0");
+      n += strspn(p + n, "0123456789");
+      if (p[n] == '.')
+        n += 1 + strspn(p + n + 1, "0123456789");
+      if (n > sizeof(spec) - 5) {
+        msg("printf: %s: invalid format\n", format);
+        return 1;
+      }
+      memcpy(spec + 1, p, n);
+      p += n;
+
+      const char *arg = *argv ? *argv++ : NULL;
+      long long num;
+
+      switch (*p) {
+        case 's':
+          strcat(spec, "s");
+          out_printf(spec, arg ? arg : "");
+          break;
+        case 'b':
+          if (arg && !out_escaped(arg))
+            return rc;
+          break;
+        case 'c':
+          if (arg && *arg)
+            out_char(*arg);
+          break;
+        case 'd':
+        case 'i':
+          strcat(spec, "lld");
+          if (!tonumber(arg, &num))
+            rc = 1;
+          out_printf(spec, num);
+          break;
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+          strcat(spec, "ll");
+          strncat(spec, p, 1);
+          if (!tonumber(arg, &num))
+            rc = 1;
+          out_printf(spec, (unsigned long long)num);
+          break;
+        default:
+          msg("printf: %%%c: invalid directive\n", *p ? *p : ' ');
+          return 1;
+      }
+
+      if (*p == '\0')
+        break;
+    }
+
+    /* Stop if the format did not consume any arguments. */
+    if (argv == first)
+      break;
+  } while (*argv);
+
+  return rc;
+}
+
+/*
+ * Expression evaluator for 'test' and '['.
+ * Operators are tried by precedence: '-o', '-a', '!', then primaries.
+ */
+typedef struct {
+  char **argv; /* remaining arguments */
+  int argc;    /* number of remaining arguments */
+  int error;   /* 1 on syntax error, 2 if error has been already reported */
+} testexpr_t;
+
+static bool test_or(testexpr_t *t);
+
+static const char *test_next(testexpr_t *t) {
+  if (t->argc == 0) {
+    t->error = max(t->error, 1);
+    return "";
+  }
+  t->argc--;
+  return *t->argv++;
+}
+
+static bool test_integer(testexpr_t *t, const char *s, long long *np) {
+  char *end;
+  errno = 0;
+  *np = strtoll(s, &end, 10);
+  if (*s == '\0' || *end || errno) {
+    msg("test: %s: integer expression expected\n", s);
+    t->error = 2;
+    return false;
+  }
+  return true;
+}
+
+static bool test_unary(char op, const char *arg) {
+  struct stat sb;
+
+  switch (op) {
+    case 'n':
+      return *arg != '\0';
+    case 'z':
+      return *arg == '\0';
+    case 't':
+      return isatty(atoi(arg));
+    case 'r':
+      return access(arg, R_OK) == 0;
+    case 'w':
+      return access(arg, W_OK) == 0;
+    case 'x':
+      return access(arg, X_OK) == 0;
+    case 'h':
+    case 'L':
+      return lstat(arg, &sb) == 0 && S_ISLNK(sb.st_mode);
+  }
+
+  if (stat(arg, &sb) < 0)
+    return false;
+
+  switch (op) {
+    case 'b':
+      return S_ISBLK(sb.st_mode);
+    case 'c':
+      return S_ISCHR(sb.st_mode);
+    case 'd':
+      return S_ISDIR(sb.st_mode);
+    case 'e':
+      return true;
+    case 'f':
+      return S_ISREG(sb.st_mode);
+    case 'g':
+      return sb.st_mode & S_ISGID;
+    case 'k':
+      return sb.st_mode & S_ISVTX;
+    case 'p':
+      return S_ISFIFO(sb.st_mode);
+    case 's':
+      return sb.st_size > 0;
+    case 'S':
+      return S_ISSOCK(sb.st_mode);
+    case 'u':
+      return sb.st_mode & S_ISUID;
+    case 'O':
+      return sb.st_uid == geteuid();
+    case 'G':
+      return sb.st_gid == getegid();
+  }
+
+  return false;
+}
+
+static bool unary_p(const char *s) {
+  return s[0] == '-' && s[1] && !s[2] && strchr("bcdefghkLnprsStuwxzOG", s[1]);
+}
+
+static const char *binops[] = {"=",   "==",  "!=",  "-eq", "-ne", "-lt", "-le",
+                               "-gt", "-ge", "-nt", "-ot", "-ef", NULL};
+
+static bool binary_p(const char *s) {
+  for (const char **op = binops; *op; op++)
+    if (!strcmp(s, *op))
+      return true;
+  return false;
+}
+
+static bool test_binary(testexpr_t *t, const char *a, const char *op,
+                        const char *b) {
+  if (!strcmp(op, "=") || !strcmp(op, "=="))
+    return !strcmp(a, b);
+  if (!strcmp(op, "!="))
+    return strcmp(a, b);
+
+  if (op[1] == 'n' || op[1] == 'o' || !strcmp(op, "-ef")) {
+    struct stat sa, sb;
+    bool ea = stat(a, &sa) == 0, eb = stat(b, &sb) == 0;
+    if (!strcmp(op, "-ef"))
+      return ea && eb && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+    if (!strcmp(op, "-nt"))
+      return ea && (!eb || sa.st_mtime > sb.st_mtime);
+    return eb && (!ea || sa.st_mtime < sb.st_mtime);
+  }
+
+  long long x, y;
+  if (!test_integer(t, a, &x) || !test_integer(t, b, &y))
+    return false;
+  if (!strcmp(op, "-eq"))
+    return x == y;
+  if (!strcmp(op, "-ne"))
+    return x != y;
+  if (!strcmp(op, "-lt"))
+    return x < y;
+  if (!strcmp(op, "-le"))
+    return x <= y;
+  if (!strcmp(op, "-gt"))
+    return x > y;
+  return x >= y;
+}
+
+static bool test_primary(testexpr_t *t) {
+  if (t->argc >= 3 && binary_p(t->argv[1])) {
+    const char *a = test_next(t), *op = test_next(t), *b = test_next(t);
+    return test_binary(t, a, op, b);
+  }
+
+  const char *arg = test_next(t);
+
+  if (!strcmp(arg, "(") && t->argc > 0) {
+    bool v = test_or(t);
+    if (strcmp(test_next(t), ")"))
+      t->error = max(t->error, 1);
+    return v;
+  }
+
+  if (unary_p(arg) && t->argc > 0)
+    return test_unary(arg[1], test_next(t));
+
+  return *arg != '\0';
+}
+
+static bool test_not(testexpr_t *t) {
+  if (t->argc > 1 && !strcmp(t->argv[0], "!")) {
+    test_next(t);
+    return !test_not(t);
+  }
+  return test_primary(t);
+}
+
+static bool test_and(testexpr_t *t) {
+  bool v = test_not(t);
+  while (t->argc > 0 && !strcmp(t->argv[0], "-a")) {
+    test_next(t);
+    v = test_not(t) && v;
+  }
+  return v;
+}
+
+static bool test_or(testexpr_t *t) {
+  bool v = test_and(t);
+  while (t->argc > 0 && !strcmp(t->argv[0], "-o")) {
+    test_next(t);
+    v = test_and(t) || v;
+  }
+  return v;
+}
+
+static int test(const char *name, char **argv, int argc) {
+  testexpr_t t = {.argv = argv, .argc = argc, .error = 0};
+
+  if (argc == 0)
+    return 1;
+
+  bool v = test_or(&t);
+  if (t.error || t.argc > 0) {
+    if (t.error < 2)
+      msg("%s: syntax error\n", name);
+    return 2;
+  }
+  return !v;
+}
+
+/*
+ * Evaluate conditional expression.
+ * 'test expr' or '[ expr ]'
+ */
+static int do_test(char **argv) {
+  int argc = 0;
+  while (argv[argc])
+    argc++;
+  return test("test", argv, argc);
+}
+
+static int do_bracket(char **argv) {
+  int argc = 0;
+  while (argv[argc])
+    argc++;
+  if (argc == 0 || strcmp(argv[argc - 1], "]")) {
+    msg("[: missing ']'\n");
+    return 2;
+  }
+  return test("[", argv, argc - 1);
+}
+
+/*
+ * Mark variables to be passed to environment of executed commands.
+ * 'export' - print exported variables
+ * 'export NAME[=VALUE]...' - export variables, optionally setting them
+ */
+static int do_export(char **argv) {
+  int rc = 0;
+
+  if (argv[0] == NULL) {
+    for (char **ep = environ; *ep; ep++)
+      out_printf("export %s\n", *ep);
+    return 0;
+  }
+
+  for (; *argv; argv++) {
+    if (assignment_p(*argv)) {
+      setvar(*argv, true);
+    } else if (varnamelen(*argv) > 0 && (*argv)[varnamelen(*argv)] == '\0') {
+      exportvar(*argv);
+    } else {
+      msg("export: '%s': not a valid identifier\n", *argv);
+      rc = 1;
+    }
+  }
+  return rc;
+}
+
+/*
+ * Remove variables.
+ * 'unset NAME...'
+ */
+static int do_unset(char **argv) {
+  for (; *argv; argv++)
+    unsetvar(*argv);
+  return 0;
+}
+
+/*
+ * Start a coprocess connected to the shell with pipes.
+ * 'coproc NAME command [args...]'
+ */
+static int do_coproc(char **argv) {
+  if (argv[0] == NULL || argv[1] == NULL ||
+      varnamelen(argv[0]) != strlen(argv[0])) {
+    msg("coproc: usage: coproc NAME command [args...]\n");
+    return 2;
+  }
+  return coproc(argv[0], argv + 1);
+}
+
 static command_t builtins[] = {
-  {"quit", do_quit}, {"cd", do_chdir},  {"jobs", do_jobs}, {"fg", do_fg},
-  {"bg", do_bg},     {"kill", do_kill}, {NULL, NULL},
+  {"quit", do_quit},           {"cd", do_chdir},
+  {"jobs", do_jobs},           {"fg", do_fg},
+  {"bg", do_bg},               {"kill", do_kill},
+  {"history", do_history},     {"true", do_true, true},
+  {"false", do_false, true},   {"echo", do_echo, true},
+  {"printf", do_printf, true}, {"test", do_test, true},
+  {"[", do_bracket, true},     {"export", do_export},
+  {"unset", do_unset},         {"coproc", do_coproc},
+  {NULL, NULL},
 };
 
-int builtin_command(char **argv) {
-  for (command_t *cmd = builtins; cmd->name; cmd++) {
-    if (strcmp(argv[0], cmd->name))
-      continue;
-    return cmd->func(&argv[1]);
+/* Builtins are found through interned entries of their names, which are
+ * created once and never released. */
+static const command_t *builtin(const char *name) {
+  static bool ready = false;
+
+  if (!ready) {
+    for (command_t *cmd = builtins; cmd->name; cmd++)
+      atomof(intern(cmd->name))->builtin = cmd;
+    ready = true;
+  }
+
+  atom_t *a = atom(name);
+  return a ? a->builtin : NULL;
+}
+
+/* Is there a builtin with that name that only produces output? */
+bool builtin_pure_p(const char *name) {
+  const command_t *cmd = builtin(name);
+  return cmd && cmd->pure;
+}
+
+/* Make builtins append their standard output to `c` unless it's redirected,
+ * or write it out again if `c` is NULL. Returns previous capture buffer. */
+capture_t *builtin_capture(capture_t *c) {
+  capture_t *prev = capture;
+  capture = c;
+  return prev;
+}
+
+/* Run builtin command within shell's process. Its standard output goes to
+ * `output` descriptor, or to stdout if it's negative. Returns -1 if there's no
+ * builtin with that name. */
+int builtin_command(char **argv, int output) {
+  const command_t *cmd = builtin(argv[0]);
+
+  if (cmd == NULL) {
+    errno = ENOENT;
+    return -1;
   }
 
-  errno = ENOENT;
-  return -1;
+  out.fd = (output >= 0) ? output : capture ? -1 : STDOUT_FILENO;
+  int rc = cmd->func(&argv[1]);
+  out_flush();
+  return rc;
+}
+
+/* Entries of commands that were resolved are kept alive by the table, so
+ * that locations survive the chunk of the line they were typed in. */
+static const char **resolved = NULL;
+static int nresolved = 0;
+
+static void pin(atom_t *a) {
+  if (a->pinned)
+    return;
+  resolved = Realloc(resolved, sizeof(char *) * (nresolved + 1));
+  resolved[nresolved++] = intern(a->str);
+  a->pinned = true;
+}
+
+/* Locations do not apply to a different PATH, so let the entries go. */
+static void unpin_all(void) {
+  for (int i = 0; i < nresolved; i++) {
+    atomof(resolved[i])->pinned = false;
+    unintern(resolved[i]);
+  }
+  nresolved = 0;
+}
+
+/* Find executable of a command in PATH and remember it in the interned entry
+ * of its name. Must be called before fork, so that the location is known to
+ * the following commands. Commands that do not come from compiled chunks are
+ * not interned and are looked up in PATH by child process. */
+void find_command(const char *name) {
+  static char *path = NULL; /* value of PATH the locations come from */
+  static unsigned pathgen = 1;
+  const char *value = getenv("PATH");
+  atom_t *a;
+
+  if (index(name, '/') || value == NULL)
+    return;
+
+  if (path == NULL || strcmp(path, value)) {
+    free(path);
+    path = strdup(value);
+    pathgen++;
+    unpin_all();
+  }
+
+  if (!(a = atom(name)) || a->builtin)
+    return;
+
+  if (a->path && a->pathgen == pathgen)
+    return;
+
+  free(a->path);
+  a->path = NULL;
+  a->pathgen = pathgen;
+
+  path_index(true);
+  const char *file = path_lookup(name);
+  if (file) {
+    a->path = strdup(file);
+    pin(a);
+    return;
+  }
+
+  for (const char *dir = value; *dir;) {
+    size_t len = strcspn(dir, ":");
+    char *file = Malloc(len + a->len + 2);
+    snprintf(file, len + a->len + 2, "%.*s/%s", (int)len, dir, name);
+    dir += len;
+    if (*dir == ':')
+      dir++;
+
+    struct stat st;
+    metric_inc(M_PROBE);
+    if (stat(file, &st) == 0 && S_ISREG(st.st_mode) && !access(file, X_OK)) {
+      a->path = file;
+      pin(a);
+      return;
+    }
+    free(file);
+  }
+}
+
+/* Called when a foreground command finished. Status 127 means it was not
+ * found, so its location is forgotten. */
+void command_done(const char *name, int status) {
+  atom_t *a = atom(name);
+
+  if (a == NULL || status != 127)
+    return;
+
+  free(a->path);
+  a->path = NULL;
 }
 
 noreturn void external_command(char **argv) {
   const char *path = getenv("PATH");
 
   if (!index(argv[0], '/') && path) {
+    /* Try the location found by parent or remembered by PATH index first.
+     * It may be stale, so fall back to searching PATH if execve fails. */
+    atom_t *a = atom(argv[0]);
+    metric_exec();
+    if (a && a->path)
+      (void)execve(a->path, argv, environ);
+    const char *file = path_lookup(argv[0]);
+    if (file)
+      (void)execve(file, argv, environ);
+
     /* TODO: For all paths in PATH construct an absolute path and execve it. */
 #ifdef STUDENT
     int size_of_current_path;
@@ -128,7 +848,10 @@ noreturn void external_command(char **argv) {
       current_path = strndup(path, size_of_current_path);
 
       // przesuwamy wskaznik na kolejna sciezke
-      path += size_of_current_path + 1;
+      // (don't step over the terminator after the last one)
+      path += size_of_current_path;
+      if (*path == ':')
+        path++;
 
       // dodajemy do sciezki "/{polecenie wpisane przez uzytkownika}"
       strapp(&current_path, "/");
@@ -138,6 +861,7 @@ noreturn void external_command(char **argv) {
       // (jezeli jest w znalezionym katalogu ze zmiennej PATH,
       // to wykona sie, jezeli nie, to zwroci -1,
       // a my bedziemy szukac dalej
+      metric_inc(M_PROBE);
       execve(current_path, argv, environ);
 
       // polecenie strndup allocuje pamiec,
@@ -146,9 +870,11 @@ noreturn void external_command(char **argv) {
     }
 #endif /* !STUDENT */
   } else {
+    metric_exec();
     (void)execve(argv[0], argv, environ);
   }
 
+  metric_inc(M_EXECFAIL);
   msg("%s: %s\n", argv[0], strerror(errno));
-  exit(EXIT_FAILURE);
+  exit(errno == ENOENT ? 127 : 126);
 }
@@ -0,0 +1,101 @@
+#include "shell.h"
+
+/*
+ * Stream of job events.
+ *
+ * With "--events SOCKET" the shell connects to a monitoring agent listening on
+ * a UNIX domain socket and sends it a JSON record per line for each change of
+ * job's life cycle. Some records come from SIGCHLD handler, so they're
+ * formatted with signal safe functions into a fixed buffer, which is written
+ * out to non-blocking socket. Shell never waits for the agent: records that do
+ * not fit into the buffer are dropped and each record carries the total number
+ * of records dropped so far.
+ */
+
+#define EVBUFSIZE 65536
+#define EVLINELEN 256
+
+static int events_fd = -1;
+static char evbuf[EVBUFSIZE];
+static size_t evlen = 0;
+static long dropped = 0;
+static pid_t events_owner; /* subshells inherit the socket and the buffer */
+
+void events_open(char *path) {
+  events_fd = Open_unix_clientfd(path);
+  fcntl(events_fd, F_SETFD, FD_CLOEXEC);
+  fcntl(events_fd, F_SETFL, O_NONBLOCK);
+  events_owner = getpid();
+}
+
+/* Send as much of buffered records as the socket accepts. If the agent went
+ * away, stop generating events. */
+static void flush(void) {
+  while (evlen > 0) {
+    ssize_t n = send(events_fd, evbuf, evlen, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        close(events_fd);
+        events_fd = -1;
+        evlen = 0;
+      }
+      return;
+    }
+    memmove(evbuf, evbuf + n, evlen - n);
+    evlen -= n;
+  }
+}
+
+/* Report event concerning process `pid` of job `j`. Status is exit status of
+ * a finished process, signal that stopped it, or -1 if not applicable.
+ * Safe to call from signal handlers. */
+void jobevent(int event, int j, pid_t pgid, pid_t pid, int state, int status,
+              const char *cmd) {
+  static const char *names[] = {
+    [EV_ADD] = "add",
+    [EV_SPAWN] = "spawn",
+    [EV_EXIT] = "exit",
+    [EV_STOP] = "stop",
+    [EV_CONTINUE] = "continue",
+    [EV_RESUME] = "resume",
+    [EV_KILL] = "kill",
+    [EV_DELETE] = "delete",
+  };
+  static const char *states[] = {
+    [FINISHED] = "finished", [RUNNING] = "running", [STOPPED] = "stopped"};
+
+  joblog(event, j, pgid, pid, state, status, cmd);
+
+  /* Jobs of subshells are not the shell's jobs. Neither do they flush what
+   * the shell has buffered, which it sends itself. */
+  if (events_fd < 0 || getpid() != events_owner)
+    return;
+
+  int old_errno = errno;
+  sigset_t mask;
+  Sigprocmask(SIG_BLOCK, &sigchld_mask, &mask);
+
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+
+  char line[EVLINELEN];
+  int len = safe_snprintf(
+    line, sizeof(line),
+    "{\"event\":\"%s\",\"job\":%d,\"pgid\":%d,\"pid\":%d,\"state\":\"%s\","
+    "\"status\":%d,\"time_ns\":%ld,\"dropped\":%ld}\n",
+    names[event], j, pgid, pid, states[state], status,
+    ts.tv_sec * 1000000000L + ts.tv_nsec, dropped);
+
+  if (evlen + len > EVBUFSIZE) {
+    dropped++;
+  } else {
+    memcpy(evbuf + evlen, line, len);
+    evlen += len;
+  }
+  flush();
+
+  Sigprocmask(SIG_SETMASK, &mask, NULL);
+  errno = old_errno;
+}
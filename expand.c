@@ -0,0 +1,339 @@
+#include "shell.h"
+
+/*
+ * Parameter expansion of command words.
+ *
+ * Brace expressions are expanded first (see brace.c). Recognized parameter
+ * forms are $NAME, ${NAME}, $?, $$, $#, $@, $* and positional parameters $1,
+ * ${10} etc., as well as ${NAME[0]} and ${NAME[1]} set by coproc builtin.
+ * Arithmetic expansion $((...)) is evaluated by the shell itself (see arith.c)
+ * and command substitution $(...) is replaced with output of the command
+ * without trailing newlines. Result of an expansion is split into fields on
+ * whitespace, unless the word is an assignment or a target of redirection.
+ * A word that expands to nothing at all is removed. Words without '$' are
+ * passed through without copying. Finally each field that contains pattern
+ * characters is replaced with sorted list of matching pathnames (see glob.c),
+ * or left intact if nothing matches.
+ */
+
+static void addtoken(words_t *w, token_t tok) {
+  if (w->ntokens == w->maxtokens) {
+    w->maxtokens = w->maxtokens ? w->maxtokens * 2 : 16;
+    /* Leave room for terminator that do_redir stores after the last token. */
+    w->token = Realloc(w->token, sizeof(token_t) * (w->maxtokens + 1));
+  }
+  w->token[w->ntokens++] = tok;
+  w->token[w->ntokens] = T_NULL;
+}
+
+static void addstr(words_t *w, char *s) {
+  if (w->nstrs == w->maxstrs) {
+    w->maxstrs = w->maxstrs ? w->maxstrs * 2 : 16;
+    w->strs = Realloc(w->strs, sizeof(char *) * w->maxstrs);
+  }
+  w->strs[w->nstrs++] = s;
+}
+
+/* Append a field, or pathnames matching it if it's a pattern. */
+static void addfield(words_t *w, token_t tok, bool pattern) {
+  char **matches;
+  int n;
+
+  if (!pattern || !glob_p(tok) || (n = pathglob(tok, &matches)) == 0) {
+    addtoken(w, tok);
+    return;
+  }
+
+  for (int i = 0; i < n; i++) {
+    addstr(w, matches[i]);
+    addtoken(w, matches[i]);
+  }
+  free(matches);
+}
+
+typedef struct {
+  char *buf;   /* field being built */
+  size_t len;  /* its length */
+  size_t size; /* its capacity */
+  bool empty;  /* nothing has been put into the field yet */
+} field_t;
+
+static void putchr(field_t *f, char c) {
+  if (f->len + 1 >= f->size) {
+    f->size = f->size ? f->size * 2 : 64;
+    f->buf = Realloc(f->buf, f->size);
+  }
+  f->buf[f->len++] = c;
+  f->empty = false;
+}
+
+static void endfield(words_t *w, field_t *f, bool split) {
+  if (f->empty)
+    return;
+  putchr(f, '\0');
+  addstr(w, f->buf);
+  addfield(w, f->buf, split);
+  *f = (field_t){.empty = true};
+}
+
+/* Returns value of parameter that starts just after '$' in `*sp` and advances
+ * the pointer past it. Sets `*validp` to false if there's no parameter. */
+static const char *param(const char **sp, bool *validp) {
+  const char *s = *sp;
+  size_t len;
+
+  *validp = true;
+
+  /* Special and positional parameters have single character names. */
+  if (*s && strchr("?$#@*0123456789", *s)) {
+    *sp = s + 1;
+    return getvar(s, 1);
+  }
+
+  if (*s == '{') {
+    len = isdigit(s[1]) ? strspn(s + 1, "0123456789") : varnamelen(s + 1);
+    /* Coprocess descriptors are kept in variables named NAME[0] and NAME[1]. */
+    if (len > 0 && s[len + 1] == '[') {
+      size_t n = strspn(s + len + 2, "0123456789");
+      if (n > 0 && s[len + n + 2] == ']')
+        len += n + 2;
+    }
+    if (len == 0 || s[len + 1] != '}') {
+      *validp = false;
+      return NULL;
+    }
+    *sp = s + len + 2;
+    return getvar(s + 1, len);
+  }
+
+  len = varnamelen(s);
+  if (len == 0) {
+    *validp = false;
+    return NULL;
+  }
+  *sp = s + len;
+  return getvar(s, len);
+}
+
+/* Returns length of `s` up to the first unmatched closing parenthesis. */
+static size_t matchparen(const char *s) {
+  int depth = 0;
+  size_t len;
+
+  for (len = 0; s[len]; len++) {
+    if (s[len] == '(')
+      depth++;
+    else if (s[len] == ')' && depth-- == 0)
+      break;
+  }
+
+  return len;
+}
+
+/* Evaluate arithmetic expansion that starts just after "$((" in `*sp` and
+ * advance the pointer past closing "))". Parameters within the expression are
+ * expanded first. */
+static bool arithmetic(const char **sp, const char *word, int64_t *valuep) {
+  const char *s = *sp;
+  size_t len = matchparen(s);
+
+  if (s[len] != ')' || s[len + 1] != ')') {
+    msg("%s: bad substitution\n", word);
+    return false;
+  }
+  *sp = s + len + 2;
+
+  char *expr = strndup(s, len);
+  bool ok;
+
+  if (strchr(expr, '$')) {
+    words_t w;
+    initwords(&w);
+    ok = expandword(&w, expr, false) &&
+         arith(w.ntokens ? w.token[0] : "", false, valuep);
+    freewords(&w);
+  } else {
+    ok = arith(expr, true, valuep);
+  }
+
+  free(expr);
+  return ok;
+}
+
+/* Run command substitution that starts just after "$(" in `*sp` and advance
+ * the pointer past closing ")". */
+static bool substitute(const char **sp, const char *word, capture_t *c) {
+  const char *s = *sp;
+  size_t len = matchparen(s);
+
+  if (s[len] != ')') {
+    msg("%s: bad substitution\n", word);
+    return false;
+  }
+  *sp = s + len + 1;
+
+  char *cmdline = strndup(s, len);
+  bool ok = cmdsubst(cmdline, c);
+  free(cmdline);
+  return ok;
+}
+
+/* Append value of an expansion to fields, splitting it on whitespace. */
+static void putvalue(words_t *w, field_t *f, const char *value, size_t len,
+                     bool split) {
+  for (size_t i = 0; i < len; i++) {
+    if (split && isspace(value[i]))
+      endfield(w, f, split);
+    else if (value[i] != '\0')
+      putchr(f, value[i]);
+  }
+}
+
+void initwords(words_t *w) {
+  *w = (words_t){.token = NULL};
+  addtoken(w, T_NULL);
+  w->ntokens = 0;
+}
+
+/* Expand a single word and append resulting fields to `w`. */
+bool expandword(words_t *w, const char *word, bool split) {
+  field_t f = {.empty = true};
+
+  for (const char *s = word; *s;) {
+    if (*s != '$') {
+      putchr(&f, *s++);
+      continue;
+    }
+
+    if (s[1] == '(' && s[2] == '(') {
+      int64_t value;
+      char buf[24];
+
+      s += 3;
+      if (!arithmetic(&s, word, &value)) {
+        free(f.buf);
+        return false;
+      }
+      snprintf(buf, sizeof(buf), "%lld", (long long)value);
+      putvalue(w, &f, buf, strlen(buf), split);
+      continue;
+    }
+
+    if (s[1] == '(') {
+      capture_t c = {NULL, 0, 0};
+
+      s += 2;
+      if (!substitute(&s, word, &c)) {
+        free(c.buf);
+        free(f.buf);
+        return false;
+      }
+      /* Output is split in place with trailing newlines dropped. */
+      while (c.len > 0 && c.buf[c.len - 1] == '\n')
+        c.len--;
+      putvalue(w, &f, c.buf, c.len, split);
+      free(c.buf);
+      continue;
+    }
+
+    bool valid;
+    const char *start = s++;
+    const char *value = param(&s, &valid);
+
+    if (!valid) {
+      if (*s == '{') {
+        msg("%s: bad substitution\n", word);
+        free(f.buf);
+        return false;
+      }
+      /* Dollar sign not followed by a name stands for itself. */
+      putchr(&f, *start);
+      continue;
+    }
+
+    if (value)
+      putvalue(w, &f, value, strlen(value), split);
+  }
+
+  endfield(w, &f, split);
+  free(f.buf);
+  return true;
+}
+
+/* Brace expansion of a word is performed before parameter expansion and its
+ * results are checked to fit into argument list before any of them is made. */
+static bool expandbraces(words_t *w, brace_t *b, const char *word) {
+  size_t count, len;
+
+  brace_size(b, &count, &len);
+  if (count > (size_t)sysconf(_SC_ARG_MAX) / (sizeof(char *) + 1) ||
+      count * (sizeof(char *) + 1) + len > (size_t)sysconf(_SC_ARG_MAX)) {
+    msg("%s: argument list too long\n", word);
+    return false;
+  }
+
+  if (w->ntokens + count > w->maxtokens) {
+    w->maxtokens = w->ntokens + count;
+    w->token = Realloc(w->token, sizeof(token_t) * (w->maxtokens + 1));
+  }
+
+  for (const char *s; (s = brace_next(b));)
+    if (!expandword(w, s, true))
+      return false;
+  return true;
+}
+
+/* Expand parameters in command tokens. Returns false if a word is malformed,
+ * in which case `w` must be freed anyway. */
+bool expand(words_t *w, token_t *token, int ntokens) {
+  initwords(w);
+
+  for (int i = 0; i < ntokens; i++) {
+    token_t tok = token[i];
+
+    if (!string_p(tok)) {
+      addtoken(w, tok);
+      continue;
+    }
+
+    bool redir =
+      i > 0 && (token[i - 1] == T_INPUT || token[i - 1] == T_OUTPUT ||
+                token[i - 1] == T_APPEND || token[i - 1] == T_DUPIN ||
+                token[i - 1] == T_DUPOUT);
+    bool split = !redir && !assignment_p(tok);
+
+    brace_t *b;
+    if (split && (b = brace_open(tok))) {
+      bool ok = expandbraces(w, b, tok);
+      brace_close(b);
+      if (!ok)
+        return false;
+      continue;
+    }
+
+    if (!strchr(tok, '$')) {
+      addfield(w, tok, split);
+      continue;
+    }
+
+    int n = w->ntokens;
+
+    if (!expandword(w, tok, split))
+      return false;
+
+    /* Redirection needs a target even if it expanded to nothing. */
+    if (redir && w->ntokens == n) {
+      addstr(w, strdup(""));
+      addtoken(w, w->strs[w->nstrs - 1]);
+    }
+  }
+
+  return true;
+}
+
+void freewords(words_t *w) {
+  for (int i = 0; i < w->nstrs; i++)
+    free(w->strs[i]);
+  free(w->strs);
+  free(w->token);
+}
@@ -0,0 +1,380 @@
+#include <dirent.h>
+
+#include "shell.h"
+#include "threadpool.h"
+
+/*
+ * Pathname expansion of words containing '*', '?' or '[...]'.
+ *
+ * Pattern is split into components at slashes and matched against directory
+ * entries one component at a time. Directories are read with getdents(2) into
+ * a large buffer and d_type saves a stat(2) call for most of the entries.
+ *
+ * Component "**" matches any number of nested directories (symbolic links are
+ * not followed). Each directory to be visited is a task run by a thread pool,
+ * which has more than one worker if the pattern contains "**". Each worker
+ * collects matches on its own, so they are merged and sorted at the end. A
+ * radix sort is used as thousands of names with long common prefixes are
+ * typical for recursive patterns.
+ */
+
+#define GLOB_BUFSIZE (256 * 1024)
+#define GLOB_MAXTHREADS 8
+
+typedef struct walk walk_t;
+
+typedef struct {
+  walk_t *walk;
+  char *buf;      /* getdents buffer */
+  char **matches; /* matches found by this worker */
+  int nmatches;
+  int maxmatches;
+} worker_t;
+
+struct walk {
+  char **comps;       /* pattern components */
+  int ncomps;         /* number of pattern components */
+  bool dirsonly;      /* pattern ends with slash */
+  threadpool_t *pool; /* runs visits of directories */
+  worker_t *workers;  /* data of each worker of the pool */
+};
+
+typedef struct {
+  walk_t *walk;
+  char *path; /* directory name, "" for current working directory */
+  int comp;   /* index of the first pattern component to match inside */
+} gitem_t;
+
+/* Returns pointer just past bracket expression starting at `p` and sets
+ * `*matchp` if it matches `c`. Returns NULL if it's not a bracket expression. */
+static const char *bracket(const char *p, char c, bool *matchp) {
+  const char *q = p + 1;
+  bool negate = false, match = false;
+
+  if (*q == '!' || *q == '^') {
+    negate = true;
+    q++;
+  }
+
+  /* Closing bracket right after opening one is taken literally. */
+  for (const char *first = q; *q && (*q != ']' || q == first); q++) {
+    char lo = *q, hi = *q;
+    if (q[1] == '-' && q[2] && q[2] != ']') {
+      hi = q[2];
+      q += 2;
+    }
+    if (lo <= c && c <= hi)
+      match = true;
+  }
+
+  if (*q != ']')
+    return NULL;
+
+  *matchp = match != negate;
+  return q + 1;
+}
+
+/* Match a single character. Returns pointer to next pattern atom or NULL. */
+static const char *matchone(const char *p, char c) {
+  bool match;
+
+  switch (*p) {
+    case '\0':
+      return NULL;
+    case '?':
+      return p + 1;
+    case '[': {
+      const char *next = bracket(p, c, &match);
+      if (next)
+        return match ? next : NULL;
+      break;
+    }
+    case '\\':
+      if (p[1])
+        return (p[1] == c) ? p + 2 : NULL;
+      break;
+  }
+
+  return (*p == c) ? p + 1 : NULL;
+}
+
+static bool match(const char *p, const char *s) {
+  const char *star = NULL, *resume = NULL;
+
+  /* Leading dot must be matched explicitly. */
+  if (*s == '.' && *p != '.')
+    return false;
+
+  while (*s) {
+    if (*p == '*') {
+      star = ++p;
+      resume = s;
+      continue;
+    }
+    const char *next = matchone(p, *s);
+    if (next) {
+      p = next;
+      s++;
+    } else if (star) {
+      /* Let the last star swallow one more character and retry. */
+      p = star;
+      s = ++resume;
+    } else {
+      return false;
+    }
+  }
+
+  while (*p == '*')
+    p++;
+  return *p == '\0';
+}
+
+/* Returns true if word contains unescaped pattern characters. */
+bool glob_p(const char *word) {
+  for (const char *s = word; *s; s++) {
+    bool dummy;
+    if (*s == '\\' && s[1])
+      s++;
+    else if (*s == '*' || *s == '?')
+      return true;
+    else if (*s == '[' && bracket(s, '\0', &dummy))
+      return true;
+  }
+  return false;
+}
+
+static char *join(const char *dir, const char *name) {
+  size_t len = strlen(dir);
+  char *path = Malloc(len + strlen(name) + 2);
+
+  if (len == 0)
+    strcpy(path, name);
+  else if (dir[len - 1] == '/')
+    sprintf(path, "%s%s", dir, name);
+  else
+    sprintf(path, "%s/%s", dir, name);
+  return path;
+}
+
+/* Use d_type if possible, otherwise stat the entry. */
+static bool isdir(int dirfd, const char *name, char type, bool follow) {
+  struct stat sb;
+
+  if (type == DT_DIR)
+    return true;
+  if (type != DT_UNKNOWN && (type != DT_LNK || !follow))
+    return false;
+  if (fstatat(dirfd, name, &sb, follow ? 0 : AT_SYMLINK_NOFOLLOW) < 0)
+    return false;
+  return S_ISDIR(sb.st_mode);
+}
+
+static void addmatch(worker_t *wk, char *path) {
+  if (wk->walk->dirsonly)
+    strapp(&path, "/");
+  if (wk->nmatches == wk->maxmatches) {
+    wk->maxmatches = wk->maxmatches ? wk->maxmatches * 2 : 64;
+    wk->matches = Realloc(wk->matches, sizeof(char *) * wk->maxmatches);
+  }
+  wk->matches[wk->nmatches++] = path;
+}
+
+static void visit_task(void *arg);
+
+/* Schedule visit of a directory. */
+static void addtodo(walk_t *w, char *path, int comp) {
+  gitem_t *item = Malloc(sizeof(gitem_t));
+  *item = (gitem_t){.walk = w, .path = path, .comp = comp};
+  threadpool_submit(w->pool, visit_task, item);
+}
+
+/* Match components starting with `i` against contents of directory `path`. */
+static void visit(worker_t *wk, const char *path, int i) {
+  walk_t *w = wk->walk;
+  struct stat sb;
+
+  /* Consecutive "**" components are equivalent to a single one. */
+  int j = i;
+  while (j < w->ncomps && !strcmp(w->comps[j], "**"))
+    j++;
+  bool recursive = j > i;
+
+  if (!recursive) {
+    if (j == w->ncomps) {
+      addmatch(wk, strdup(path));
+      return;
+    }
+    /* Component without pattern characters needs no directory listing. */
+    if (!glob_p(w->comps[j])) {
+      char *next = join(path, w->comps[j]);
+      if (j + 1 < w->ncomps) {
+        visit(wk, next, j + 1);
+      } else if (fstatat(AT_FDCWD, next, &sb, AT_SYMLINK_NOFOLLOW) == 0 &&
+                 (!w->dirsonly || isdir(AT_FDCWD, next, DT_UNKNOWN, true))) {
+        addmatch(wk, next);
+        return;
+      }
+      free(next);
+      return;
+    }
+  }
+
+  int fd = open(*path ? path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0)
+    return;
+
+  int n;
+  while ((n = Getdents(fd, (struct linux_dirent *)wk->buf, GLOB_BUFSIZE)) > 0) {
+    for (int off = 0; off < n;) {
+      struct linux_dirent *d = (struct linux_dirent *)(wk->buf + off);
+      char type = wk->buf[off + d->d_reclen - 1];
+      const char *name = d->d_name;
+      off += d->d_reclen;
+
+      if (!strcmp(name, ".") || !strcmp(name, ".."))
+        continue;
+
+      bool last = (j + 1 >= w->ncomps);
+
+      if (j < w->ncomps ? match(w->comps[j], name) : name[0] != '.') {
+        if (j < w->ncomps && !last) {
+          if (isdir(fd, name, type, true))
+            addtodo(w, join(path, name), j + 1);
+        } else if (!w->dirsonly || isdir(fd, name, type, true)) {
+          addmatch(wk, join(path, name));
+        }
+      }
+
+      if (recursive && name[0] != '.' && isdir(fd, name, type, false))
+        addtodo(w, join(path, name), i);
+    }
+  }
+
+  Close(fd);
+}
+
+static void visit_task(void *arg) {
+  gitem_t *item = arg;
+  walk_t *w = item->walk;
+  worker_t *wk = &w->workers[threadpool_self(w->pool)];
+
+  if (wk->buf == NULL)
+    wk->buf = Malloc(GLOB_BUFSIZE);
+
+  visit(wk, item->path, item->comp);
+  free(item->path);
+  free(item);
+}
+
+/* Sort strings by bytes starting at `depth`, which all of them share. */
+static void msdsort(char **v, char **tmp, uint8_t *keys, int n, int depth) {
+  while (n > 1) {
+    if (n < 32) {
+      for (int i = 1; i < n; i++) {
+        char *s = v[i];
+        int k = i;
+        for (; k > 0 && strcmp(v[k - 1] + depth, s + depth) > 0; k--)
+          v[k] = v[k - 1];
+        v[k] = s;
+      }
+      return;
+    }
+
+    /* Cache the current byte of each string, so that the counting and the
+     * distribution passes scan a dense array instead of chasing pointers. */
+    int count[256] = {0};
+    for (int i = 0; i < n; i++)
+      count[keys[i] = v[i][depth]]++;
+
+    /* Common case of all strings sharing the byte does not need to move
+     * anything. Strings that ended are equal, so they're done. */
+    if (count[keys[0]] == n) {
+      if (keys[0] == 0)
+        return;
+      depth++;
+      continue;
+    }
+
+    int start[256];
+    for (int c = 0, sum = 0; c < 256; c++) {
+      start[c] = sum;
+      sum += count[c];
+    }
+    int pos[256];
+    memcpy(pos, start, sizeof(pos));
+    for (int i = 0; i < n; i++)
+      tmp[pos[keys[i]]++] = v[i];
+    memcpy(v, tmp, sizeof(char *) * n);
+
+    for (int c = 1; c < 256; c++)
+      if (count[c] > 1)
+        msdsort(v + start[c], tmp, keys, count[c], depth + 1);
+    return;
+  }
+}
+
+static void radixsort(char **v, int n) {
+  char **tmp = Malloc(sizeof(char *) * n);
+  uint8_t *keys = Malloc(n);
+  msdsort(v, tmp, keys, n, 0);
+  free(keys);
+  free(tmp);
+}
+
+/* Expand pattern into sorted array of matching paths. Returns number of
+ * matches. If nothing matched `*matchesp` is set to NULL. */
+int pathglob(const char *pattern, char ***matchesp) {
+  walk_t w = {.dirsonly = false};
+  char *copy = strdup(pattern);
+  bool parallel = false;
+
+  /* Split pattern into non-empty components. */
+  for (char *s = copy, *comp; (comp = strsep(&s, "/"));) {
+    if (*comp == '\0')
+      continue;
+    w.comps = Realloc(w.comps, sizeof(char *) * (w.ncomps + 1));
+    w.comps[w.ncomps++] = comp;
+    if (!strcmp(comp, "**"))
+      parallel = true;
+  }
+  w.dirsonly = pattern[0] && pattern[strlen(pattern) - 1] == '/';
+
+  /* Calling thread is one of the workers. */
+  int nworkers = 1;
+  if (parallel) {
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    nworkers = min(max(ncpus, 1), GLOB_MAXTHREADS);
+  }
+  w.pool = threadpool_create(nworkers);
+  worker_t *wk = w.workers = Calloc(nworkers, sizeof(worker_t));
+  for (int i = 0; i < nworkers; i++)
+    wk[i].walk = &w;
+
+  addtodo(&w, strdup(*pattern == '/' ? "/" : ""), 0);
+  threadpool_destroy(w.pool);
+
+  int n = 0;
+  for (int i = 0; i < nworkers; i++)
+    n += wk[i].nmatches;
+
+  char **matches = NULL;
+  if (n > 0) {
+    matches = Malloc(sizeof(char *) * n);
+    for (int i = 0, k = 0; i < nworkers; i++) {
+      memcpy(matches + k, wk[i].matches, sizeof(char *) * wk[i].nmatches);
+      k += wk[i].nmatches;
+    }
+    radixsort(matches, n);
+  }
+
+  for (int i = 0; i < nworkers; i++) {
+    free(wk[i].buf);
+    free(wk[i].matches);
+  }
+  free(wk);
+  free(w.comps);
+  free(copy);
+
+  *matchesp = matches;
+  return n;
+}
@@ -0,0 +1,319 @@
+#include "shell.h"
+
+/*
+ * Persistent command history.
+ *
+ * History file is an append-only sequence of records. Each record is a fixed
+ * header followed by NUL-terminated command text padded to 8 bytes. A new
+ * command is appended with a single write(2) on a descriptor opened with
+ * O_APPEND, so records of concurrent shells never interleave.
+ *
+ * Shell maps the file read-only instead of reading and parsing it. Index
+ * refers to records by their offsets within the mapping. Deduplication is done
+ * with a hash table keyed by jenkins_hash of command text. Substring search
+ * consults a trigram index to pick a short list of candidate entries.
+ *
+ * Nothing is read at startup. The index is built by the first search and
+ * later searches only index records appended since then, so a shell that
+ * never searches history never pays for it.
+ */
+
+#define HIST_MAGIC 0x54534948 /* "HIST" */
+#define HIST_MAPMIN (1 << 20) /* reserve at least that much address space */
+
+typedef struct {
+  uint32_t magic; /* marks beginning of a valid record */
+  uint32_t size;  /* length of command text including NUL terminator */
+  uint32_t hash;  /* jenkins_hash of command text */
+  uint32_t pad;
+} hrec_t;
+
+#define HREC_SIZE(n) (sizeof(hrec_t) + (((n) + 7) & ~7))
+
+typedef struct {
+  uint32_t key; /* trigram + 1, 0 if slot is free */
+  int nids;     /* number of entries in posting list */
+  int maxids;   /* capacity of posting list */
+  int *ids;     /* entries containing trigram in ascending order */
+} trigram_t;
+
+static char *hist_path = NULL; /* NULL if history is disabled */
+static char *map = NULL;       /* read-only mapping of history file */
+static size_t mapsize = 0;     /* length of mapping (may exceed file size) */
+static size_t indexed = 0;     /* records before this offset are indexed */
+static ino_t inode = 0;        /* identity of the file that is indexed */
+static char *last = NULL;      /* command most recently added by this shell */
+
+static size_t *entries = NULL; /* record offsets, oldest first */
+static bool *live = NULL;      /* false if entry was superseded by newer one */
+static int nentries = 0;
+static int maxentries = 0;
+
+static int *dedup = NULL; /* hash table of entry numbers, -1 if free */
+static int ndedup = 0;    /* number of slots (power of 2) */
+
+static trigram_t *trigrams = NULL; /* hash table of posting lists */
+static int ntrigrams = 0;          /* number of used slots */
+static int maxtrigrams = 0;        /* number of slots (power of 2) */
+
+static inline hrec_t *hrec(int e) {
+  return (hrec_t *)(map + entries[e]);
+}
+
+static inline const char *htext(int e) {
+  return (const char *)(hrec(e) + 1);
+}
+
+/* Returns slot in dedup table where entry for given command is or should be
+ * stored. */
+static int dedup_slot(const char *cmd, uint32_t hash) {
+  for (int i = hash & (ndedup - 1);; i = (i + 1) & (ndedup - 1)) {
+    int e = dedup[i];
+    if (e < 0 || (hrec(e)->hash == hash && !strcmp(htext(e), cmd)))
+      return i;
+  }
+}
+
+static void dedup_grow(void) {
+  int *old = dedup;
+  int nold = ndedup;
+
+  ndedup = ndedup ? ndedup * 2 : 1024;
+  dedup = Malloc(sizeof(int) * ndedup);
+  memset(dedup, -1, sizeof(int) * ndedup);
+
+  for (int i = 0; i < nold; i++)
+    if (old[i] >= 0)
+      dedup[dedup_slot(htext(old[i]), hrec(old[i])->hash)] = old[i];
+  free(old);
+}
+
+static trigram_t *trigram_slot(uint32_t key) {
+  uint32_t h = jenkins_hash(&key, sizeof(key), HASHINIT);
+  for (int i = h & (maxtrigrams - 1);; i = (i + 1) & (maxtrigrams - 1)) {
+    trigram_t *t = &trigrams[i];
+    if (t->key == 0 || t->key == key)
+      return t;
+  }
+}
+
+static void trigram_grow(void) {
+  trigram_t *old = trigrams;
+  int nold = maxtrigrams;
+
+  maxtrigrams = maxtrigrams ? maxtrigrams * 2 : 4096;
+  trigrams = Calloc(maxtrigrams, sizeof(trigram_t));
+
+  for (int i = 0; i < nold; i++)
+    if (old[i].key)
+      *trigram_slot(old[i].key) = old[i];
+  free(old);
+}
+
+static inline uint32_t trigram_key(const char *s) {
+  const uint8_t *u = (const uint8_t *)s;
+  return ((u[0] << 16) | (u[1] << 8) | u[2]) + 1;
+}
+
+static void trigram_add(uint32_t key, int e) {
+  if (2 * (ntrigrams + 1) > maxtrigrams)
+    trigram_grow();
+
+  trigram_t *t = trigram_slot(key);
+  if (t->key == 0) {
+    t->key = key;
+    ntrigrams++;
+  }
+  /* Posting lists are sorted, so a repeated trigram hits the last element. */
+  if (t->nids > 0 && t->ids[t->nids - 1] == e)
+    return;
+  if (t->nids == t->maxids) {
+    t->maxids = t->maxids ? t->maxids * 2 : 4;
+    t->ids = Realloc(t->ids, sizeof(int) * t->maxids);
+  }
+  t->ids[t->nids++] = e;
+}
+
+static void index_record(size_t off) {
+  if (nentries == maxentries) {
+    maxentries = maxentries ? maxentries * 2 : 1024;
+    entries = Realloc(entries, sizeof(size_t) * maxentries);
+    live = Realloc(live, sizeof(bool) * maxentries);
+  }
+
+  int e = nentries++;
+  entries[e] = off;
+  live[e] = true;
+
+  if (2 * nentries > ndedup)
+    dedup_grow();
+
+  const char *cmd = htext(e);
+  int slot = dedup_slot(cmd, hrec(e)->hash);
+  if (dedup[slot] >= 0)
+    live[dedup[slot]] = false;
+  dedup[slot] = e;
+
+  for (const char *s = cmd; s[0] && s[1] && s[2]; s++)
+    trigram_add(trigram_key(s), e);
+}
+
+/* Forget the index and the mapping of a file that is gone. */
+static void hist_drop(void) {
+  for (int i = 0; i < maxtrigrams; i++)
+    free(trigrams[i].ids);
+  free(trigrams);
+  trigrams = NULL;
+  ntrigrams = maxtrigrams = 0;
+
+  free(dedup);
+  dedup = NULL;
+  ndedup = 0;
+
+  free(entries);
+  free(live);
+  entries = NULL;
+  live = NULL;
+  nentries = maxentries = 0;
+
+  if (map)
+    Munmap(map, mapsize);
+  map = NULL;
+  mapsize = 0;
+  indexed = 0;
+}
+
+/* Map whatever has been appended to history file since last call
+ * (possibly by other shells) and add new records to the index. */
+static void hist_sync(void) {
+  struct stat sb;
+
+  if (hist_path == NULL || stat(hist_path, &sb) < 0)
+    return;
+
+  /* Truncated or replaced file must not be read through the old mapping,
+   * past its end or from a different inode. */
+  size_t size = sb.st_size;
+  if (size < indexed || (indexed > 0 && sb.st_ino != inode))
+    hist_drop();
+  inode = sb.st_ino;
+  if (size <= indexed)
+    return;
+
+  if (size > mapsize) {
+    int fd = open(hist_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      return;
+    if (map)
+      Munmap(map, mapsize);
+    /* Pages past the end of file become accessible as the file grows,
+     * so reserve some address space up front to avoid remapping. */
+    for (mapsize = HIST_MAPMIN; mapsize < size * 2; mapsize *= 2)
+      continue;
+    map = Mmap(NULL, mapsize, PROT_READ, MAP_SHARED, fd, 0);
+    Close(fd);
+  }
+
+  while (indexed + sizeof(hrec_t) <= size) {
+    hrec_t *r = (hrec_t *)(map + indexed);
+    /* Stop at a record that is corrupted or still being written. */
+    if (r->magic != HIST_MAGIC || r->size == 0 ||
+        indexed + HREC_SIZE(r->size) > size ||
+        ((char *)(r + 1))[r->size - 1] != '\0')
+      break;
+    index_record(indexed);
+    indexed += HREC_SIZE(r->size);
+  }
+}
+
+/* Called just at the beginning of shell's life. */
+void hist_init(void) {
+  const char *path = getenv("HISTFILE");
+
+  if (path) {
+    hist_path = strdup(path);
+  } else if ((path = getenv("HOME"))) {
+    strapp(&hist_path, path);
+    strapp(&hist_path, "/.shell_history");
+  }
+}
+
+/* Append command to history file unless this shell has just added it. */
+void hist_add(const char *cmd) {
+  if (hist_path == NULL || (last && !strcmp(last, cmd)))
+    return;
+
+  free(last);
+  last = strdup(cmd);
+
+  size_t len = strlen(cmd) + 1;
+  size_t size = HREC_SIZE(len);
+  char *buf = Calloc(1, size);
+  memcpy(buf + sizeof(hrec_t), cmd, len);
+
+  *(hrec_t *)buf = (hrec_t){.magic = HIST_MAGIC,
+                            .size = len,
+                            .hash = jenkins_strhash(cmd, len - 1)};
+
+  int fd = open(hist_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+                S_IRUSR | S_IWUSR);
+  if (fd >= 0) {
+    if (write(fd, buf, size) != (ssize_t)size)
+      msg("history: %s: %s\n", hist_path, strerror(errno));
+    Close(fd);
+  }
+  free(buf);
+}
+
+/* Find the most recent command containing `pattern` that is older than entry
+ * number `*cursorp`. Negative cursor starts the search with the newest entry.
+ * Returns NULL if nothing was found, otherwise updates the cursor so that
+ * repeated calls yield consecutive matches. */
+const char *hist_find(const char *pattern, int *cursorp) {
+  hist_sync();
+
+  int e = (*cursorp < 0 || *cursorp > nentries) ? nentries : *cursorp;
+  size_t len = strlen(pattern);
+
+  if (len < 3) {
+    while (--e >= 0) {
+      if (live[e] && strstr(htext(e), pattern))
+        goto found;
+    }
+    return NULL;
+  }
+
+  if (ntrigrams == 0)
+    return NULL;
+
+  /* Candidates come from the shortest posting list among pattern trigrams. */
+  trigram_t *best = NULL;
+  for (size_t i = 0; i + 3 <= len; i++) {
+    trigram_t *t = trigram_slot(trigram_key(pattern + i));
+    if (t->key == 0)
+      return NULL;
+    if (best == NULL || t->nids < best->nids)
+      best = t;
+  }
+
+  /* Binary search for the first candidate not older than the cursor. */
+  int lo = 0, hi = best->nids;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (best->ids[mid] < e)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  while (--lo >= 0) {
+    e = best->ids[lo];
+    if (live[e] && strstr(htext(e), pattern))
+      goto found;
+  }
+  return NULL;
+
+found:
+  *cursorp = e;
+  return htext(e);
+}
@@ -12,6 +12,7 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/uio.h>
+#include <sys/un.h>
 #include <sys/user.h>
 #include <sys/wait.h>
 #include <arpa/inet.h>
@@ -83,11 +84,14 @@ noreturn void gai_error(int code, const char *fmt, ...)
 /* Signal safe I/O functions */
 void safe_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
 void safe_error(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+int safe_snprintf(char *buf, size_t size, const char *fmt, ...)
+  __attribute__((format(printf, 3, 4)));
 
 /* Decent hashing function. */
 #define HASHINIT 5381
 
 uint32_t jenkins_hash(const void *key, size_t length, uint32_t initval);
+uint32_t jenkins_strhash(const char *s, size_t length);
 
 /* Memory allocation wrappers */
 void *Malloc(size_t size);
@@ -113,6 +117,7 @@ void Sigsuspend(const sigset_t *mask);
 
 /* Process group control wrappers */
 void Setpgid(pid_t pid, pid_t pgid);
+pid_t Setsid(void);
 
 /* Stdio wrappers */
 char *Fgets(char *ptr, int n, FILE *stream);
@@ -200,6 +205,21 @@ int open_clientfd(char *hostname, char *port);
 int Open_clientfd(char *hostname, char *port);
 int open_listenfd(char *port, int backlog);
 int Open_listenfd(char *port, int backlog);
+int open_hostlistenfd(char *host, char *port, int backlog);
+int Open_hostlistenfd(char *host, char *port, int backlog);
+
+/* UNIX domain socket wrappers. */
+#define MAXFDPASS 16 /* maximum number of descriptors passed at once */
+int open_unix_clientfd(char *path);
+int Open_unix_clientfd(char *path);
+int open_unix_listenfd(char *path, int backlog);
+int Open_unix_listenfd(char *path, int backlog);
+ssize_t send_fds(int sock, const void *buf, size_t len, const int *fds,
+                 int nfds);
+ssize_t recv_fds(int sock, void *buf, size_t len, int *fds, int *nfdsp);
+#ifdef LINUX
+int getpeereid(int sock, uid_t *euid, gid_t *egid); /* BSD provides it */
+#endif
 
 /* POSIX thread control wrappers. */
 
@@ -0,0 +1,33 @@
+#ifndef _THREADPOOL_H_
+#define _THREADPOOL_H_
+
+/*
+ * Work-stealing thread pool.
+ *
+ * Each worker owns a deque of tasks. Tasks submitted by a worker are pushed
+ * onto its own deque and popped in LIFO order, which keeps the working set of
+ * recursive computations small. An idle worker steals the oldest task from
+ * deque of another worker, and parks when there's nothing to steal.
+ *
+ * The thread that calls `threadpool_wait` acts as worker 0 until all tasks
+ * are done, so a pool of n workers runs n-1 threads, and a pool of a single
+ * worker runs all tasks in the calling thread.
+ */
+
+typedef struct threadpool threadpool_t;
+typedef void (*task_fn_t)(void *arg);
+
+/* Start pool of `nworkers` workers, or one per CPU if it's not positive. */
+threadpool_t *threadpool_create(int nworkers);
+/* Wait for the tasks to finish, stop the threads and free the pool. */
+void threadpool_destroy(threadpool_t *tp);
+/* Queue a task. Can be called by the owner of the pool or by a task. */
+void threadpool_submit(threadpool_t *tp, task_fn_t fn, void *arg);
+/* Run tasks in the calling thread until all of them are done. */
+void threadpool_wait(threadpool_t *tp);
+/* Returns number of workers. */
+int threadpool_size(threadpool_t *tp);
+/* Returns index of worker running the calling thread, for per-worker data. */
+int threadpool_self(threadpool_t *tp);
+
+#endif /* !_THREADPOOL_H_ */
@@ -0,0 +1,96 @@
+#include <stddef.h>
+
+#include "shell.h"
+
+/*
+ * Table of interned strings.
+ *
+ * Words of compiled command lines are stored in the table once, no matter how
+ * many chunks or function bodies refer to them. Entries are reference counted
+ * and removed when the last reference is dropped. An entry for a command name
+ * keeps what the name refers to: a builtin, a shell function and location of
+ * the executable, so that command dispatch needs a single hash table lookup.
+ */
+
+static atom_t **buckets = NULL;
+static size_t nbuckets = 0; /* power of two */
+static size_t natoms = 0;
+
+static atom_t **lookup(const char *s, size_t len, uint32_t hash) {
+  atom_t **ap = &buckets[hash & (nbuckets - 1)];
+  for (; *ap; ap = &(*ap)->next) {
+    atom_t *a = *ap;
+    if (a->hash == hash && a->len == len && !memcmp(a->str, s, len))
+      break;
+  }
+  return ap;
+}
+
+static void rehash(size_t size) {
+  atom_t **old = buckets;
+  size_t oldsize = nbuckets;
+
+  buckets = Calloc(size, sizeof(atom_t *));
+  nbuckets = size;
+
+  for (size_t i = 0; i < oldsize; i++) {
+    while (old[i]) {
+      atom_t *a = old[i];
+      old[i] = a->next;
+      a->next = buckets[a->hash & (size - 1)];
+      buckets[a->hash & (size - 1)] = a;
+    }
+  }
+
+  free(old);
+}
+
+/* Returns entry for string or NULL if it has not been interned. */
+atom_t *atom(const char *s) {
+  if (natoms == 0)
+    return NULL;
+  size_t len = strlen(s);
+  return *lookup(s, len, jenkins_strhash(s, len));
+}
+
+/* Returns entry of a string returned by `intern`. */
+atom_t *atomof(const char *s) {
+  return (atom_t *)(s - offsetof(atom_t, str));
+}
+
+/* Returns interned copy of a string, which must be released by `unintern`. */
+const char *intern(const char *s) {
+  if (nbuckets == 0)
+    rehash(256);
+
+  size_t len = strlen(s);
+  uint32_t hash = jenkins_strhash(s, len);
+  atom_t **ap = lookup(s, len, hash);
+
+  if (*ap == NULL) {
+    atom_t *a = Calloc(1, sizeof(atom_t) + len + 1);
+    a->hash = hash;
+    a->len = len;
+    memcpy(a->str, s, len);
+    *ap = a;
+    if (++natoms > nbuckets)
+      rehash(nbuckets * 2);
+    ap = lookup(s, len, hash);
+  }
+
+  (*ap)->refcnt++;
+  return (*ap)->str;
+}
+
+void unintern(const char *s) {
+  atom_t *a = atomof(s);
+
+  if (--a->refcnt > 0)
+    return;
+
+  atom_t **ap = lookup(a->str, a->len, a->hash);
+  *ap = a->next;
+  natoms--;
+  free(a->path);
+  free(a);
+}
@@ -0,0 +1,76 @@
+#include "shell.h"
+
+/*
+ * Reader of job log written by "shell --joblog FILE", see joblog.c.
+ *
+ * Prints records in the order they were made, one per line. With "-f" keeps
+ * watching the file and prints new records as they appear. Writers never
+ * wait for the reader, so records overwritten before they were read are
+ * reported as lost. A record left unfinished by a writer that died is
+ * reported as incomplete, when following after a while.
+ */
+
+static const char *events[] = {
+  [EV_ADD] = "add",
+  [EV_SPAWN] = "spawn",
+  [EV_EXIT] = "exit",
+  [EV_STOP] = "stop",
+  [EV_CONTINUE] = "continue",
+  [EV_RESUME] = "resume",
+  [EV_KILL] = "kill",
+  [EV_DELETE] = "delete",
+};
+
+static const char *states[] = {
+  [FINISHED] = "finished", [RUNNING] = "running", [STOPPED] = "stopped"};
+
+static bool follow = false;
+
+static void print(const void *r) {
+  const jlrec_t *rec = r;
+  char cmd[sizeof(rec->command) + 1];
+  memcpy(cmd, rec->command, sizeof(rec->command));
+  cmd[sizeof(rec->command)] = '\0';
+
+  printf("%lu %ld.%09ld %d %-8s [%d] %d %d %s %d %s\n", (unsigned long)rec->seq,
+         (long)(rec->time_ns / 1000000000), (long)(rec->time_ns % 1000000000),
+         rec->shell, rec->event < EV_COUNT ? events[rec->event] : "?", rec->job,
+         rec->pgid, rec->pid, rec->state <= STOPPED ? states[rec->state] : "?",
+         rec->status, cmd);
+}
+
+int main(int argc, char *argv[]) {
+  int opt;
+
+  while ((opt = getopt(argc, argv, "f")) != -1) {
+    if (opt == 'f')
+      follow = true;
+    else
+      app_error("usage: %s [-f] FILE", argv[0]);
+  }
+  if (optind + 1 != argc)
+    app_error("usage: %s [-f] FILE", argv[0]);
+
+  int fd = Open(argv[optind], O_RDONLY, 0);
+  struct stat sb;
+  Fstat(fd, &sb);
+  if ((size_t)sb.st_size < sizeof(jlhdr_t))
+    app_error("%s: not a job log", argv[optind]);
+  jlhdr_t *hdr = Mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  Close(fd);
+
+  if (!ring_valid(&hdr->ring, JOBLOG_MAGIC, sizeof(jlrec_t), sizeof(jlhdr_t),
+                  sb.st_size))
+    app_error("%s: not a job log", argv[optind]);
+
+  ring_reader_t rd = {.hdr = &hdr->ring, .recs = hdr + 1, .next = 1};
+  while (true) {
+    ring_dump(&rd, follow, print);
+    if (!follow)
+      break;
+    struct timespec ts = {.tv_sec = 0, .tv_nsec = 100000000};
+    nanosleep(&ts, NULL);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,70 @@
+#include "shell.h"
+
+/*
+ * Binary log of job life cycle.
+ *
+ * With "--joblog FILE" every event reported by `jobevent` is also stored as
+ * a fixed size record in a ring kept in a shared mapping of the file (see
+ * ring.h). Storing a record takes no system calls, and records made by
+ * SIGCHLD handler and by concurrent shells sharing the file never overlap.
+ * The file outlives the shell, so "jlog" tool can dump it after a session
+ * crashed or attach to a hung one.
+ */
+
+static jlhdr_t *hdr = NULL;
+static jlrec_t *ring = NULL;
+static pid_t shellpid; /* refreshed in forked subshells */
+
+static void joblog_atfork(void) {
+  shellpid = getpid();
+}
+
+void joblog_open(char *path) {
+  size_t size = sizeof(jlhdr_t) + sizeof(jlrec_t) * JOBLOG_NRECS;
+  int fd = Open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+  struct stat sb;
+  Fstat(fd, &sb);
+  if ((size_t)sb.st_size != size)
+    Ftruncate(fd, size);
+
+  hdr = Mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  Close(fd);
+
+  /* Start over if the file is not a log of the same layout. */
+  if (!ring_valid(&hdr->ring, JOBLOG_MAGIC, sizeof(jlrec_t), sizeof(jlhdr_t),
+                  size) ||
+      hdr->ring.nrecs != JOBLOG_NRECS) {
+    memset(hdr, 0, size);
+    hdr->ring.recsize = sizeof(jlrec_t);
+    hdr->ring.nrecs = JOBLOG_NRECS;
+    __atomic_store_n(&hdr->ring.magic, JOBLOG_MAGIC, __ATOMIC_RELEASE);
+  }
+
+  ring = (jlrec_t *)(hdr + 1);
+  shellpid = getpid();
+  pthread_atfork(NULL, NULL, joblog_atfork);
+}
+
+/* Store a record. Safe to call from signal handlers. */
+void joblog(int event, int j, pid_t pgid, pid_t pid, int state, int status,
+            const char *cmd) {
+  if (hdr == NULL)
+    return;
+
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+
+  jlrec_t rec = {.time_ns = ts.tv_sec * 1000000000L + ts.tv_nsec,
+                 .shell = shellpid,
+                 .pid = pid,
+                 .pgid = pgid,
+                 .status = status,
+                 .job = j,
+                 .event = event,
+                 .state = state};
+  for (size_t i = 0; cmd && cmd[i] && i < sizeof(rec.command) - 1; i++)
+    rec.command[i] = cmd[i];
+
+  ring_put(&hdr->ring, ring, &rec);
+}
@@ -13,6 +13,7 @@ typedef struct job {
   int nproc;             /* number of processes */
   int state;             /* changes when live processes have same state */
   char *command;         /* textual representation of command line */
+  int pipes[2];          /* coprocess: shell's ends of pipes or -1 */
 } job_t;
 
 static job_t *jobs = NULL;          /* array of all jobs */
@@ -20,6 +21,15 @@ static int njobmax = 1;             /* number of slots in jobs array */
 static int tty_fd = -1;             /* controlling terminal file descriptor */
 static struct termios shell_tmodes; /* saved shell terminal modes */
 
+/* Publish number of jobs in each state. Safe to call from signal handlers. */
+static void countjobs(void) {
+  int count[STOPPED + 1] = {0};
+  for (int j = 0; j < njobmax; j++)
+    if (jobs[j].pgid)
+      count[jobs[j].state]++;
+  metric_jobs(count[RUNNING], count[STOPPED], count[FINISHED]);
+}
+
 static void sigchld_handler(int sig) {
   int old_errno = errno;
   pid_t pid;
@@ -59,12 +69,18 @@ static void sigchld_handler(int sig) {
           jobs[i].proc[j].state = FINISHED;
           jobs[i].proc[j].exitcode = status;
           finished_n++;
+          jobevent(EV_EXIT, i, jobs[i].pgid, pid, FINISHED, exitstatus(status),
+                   jobs[i].command);
         } else if (WIFSTOPPED(status)) {
           jobs[i].proc[j].state = STOPPED;
           stopped_n++;
+          jobevent(EV_STOP, i, jobs[i].pgid, pid, STOPPED, WSTOPSIG(status),
+                   jobs[i].command);
         } else if (WIFCONTINUED(status)) {
           jobs[i].proc[j].state = RUNNING;
           running_n++;
+          jobevent(EV_CONTINUE, i, jobs[i].pgid, pid, RUNNING, -1,
+                   jobs[i].command);
         }
       } else {
 
@@ -91,6 +107,7 @@ static void sigchld_handler(int sig) {
     }
   }
 #endif /* !STUDENT */
+  countjobs();
   errno = old_errno;
 }
 
@@ -99,6 +116,13 @@ static int exitcode(job_t *job) {
   return job->proc[job->nproc - 1].exitcode;
 }
 
+/* Translate wait status into exit status in the way shells report it. */
+int exitstatus(int status) {
+  if (WIFSIGNALED(status))
+    return 128 + WTERMSIG(status);
+  return WEXITSTATUS(status);
+}
+
 static int allocjob(void) {
   /* Find empty slot for background job. */
   for (int j = BG; j < njobmax; j++)
@@ -127,17 +151,26 @@ int addjob(pid_t pgid, int bg) {
   job->proc = NULL;
   job->nproc = 0;
   job->tmodes = shell_tmodes;
+  job->pipes[0] = job->pipes[1] = -1;
+  jobevent(EV_ADD, j, pgid, pgid, RUNNING, -1, NULL);
+  countjobs();
   return j;
 }
 
 static void deljob(job_t *job) {
   assert(job->state == FINISHED);
+  jobevent(EV_DELETE, job - jobs, job->pgid, job->pgid, FINISHED,
+           exitstatus(exitcode(job)), job->command);
   free(job->command);
   free(job->proc);
+  for (int i = 0; i < 2; i++)
+    if (job->pipes[i] >= 0)
+      Close(job->pipes[i]);
   job->pgid = 0;
   job->command = NULL;
   job->proc = NULL;
   job->nproc = 0;
+  countjobs();
 }
 
 static void movejob(int from, int to) {
@@ -147,13 +180,27 @@ static void movejob(int from, int to) {
 }
 
 static void mkcommand(char **cmdp, char **argv) {
-  if (*cmdp)
-    strapp(cmdp, " | ");
+  /* Size the string up front, as argv may be a long brace expansion. */
+  size_t len = *cmdp ? strlen(*cmdp) : 0;
+  size_t size = len + (*cmdp ? 3 : 0);
+  for (char **arg = argv; *arg; arg++)
+    size += strlen(*arg) + 1;
+
+  char *cmd = Realloc(*cmdp, size);
+  if (len > 0) {
+    memcpy(cmd + len, " | ", 3);
+    len += 3;
+  }
 
-  for (strapp(cmdp, *argv++); *argv; argv++) {
-    strapp(cmdp, " ");
-    strapp(cmdp, *argv);
+  for (char **arg = argv; *arg; arg++) {
+    if (arg != argv)
+      cmd[len++] = ' ';
+    size_t n = strlen(*arg);
+    memcpy(cmd + len, *arg, n);
+    len += n;
   }
+  cmd[len] = '\0';
+  *cmdp = cmd;
 }
 
 void addproc(int j, pid_t pid, char **argv) {
@@ -167,6 +214,15 @@ void addproc(int j, pid_t pid, char **argv) {
   proc->state = RUNNING;
   proc->exitcode = -1;
   mkcommand(&job->command, argv);
+  jobevent(EV_SPAWN, j, job->pgid, pid, RUNNING, -1, job->command);
+}
+
+/* Make coprocess job own shell's ends of pipes connected to it, so that
+ * they're closed when the job is gone. */
+void addpipes(int j, int input, int output) {
+  assert(j < njobmax);
+  jobs[j].pipes[0] = input;
+  jobs[j].pipes[1] = output;
 }
 
 /* Returns job's state.
@@ -217,6 +273,9 @@ bool resumejob(int j, int bg, sigset_t *mask) {
 
   // zmieniamy stan na running
   jobs[j].state = RUNNING;
+  jobevent(EV_RESUME, j, jobs[j].pgid, jobs[j].pgid, RUNNING, -1,
+           jobs[j].command);
+  countjobs();
   // wysylamy sygnal SIGCONT dla wszystkich procesow
   // z grupy procesow ktora chcemy wznowic
   if (bg) {
@@ -250,6 +309,8 @@ bool killjob(int j) {
   // wysylamy sygnal terminujacy dla wszystkich procesow z danej grupy
   // wysylamy sigcont'a aby procesy,
   // ktore sa zatrzymane mogly zareagowac na sigterm'a
+  jobevent(EV_KILL, j, jobs[j].pgid, jobs[j].pgid, jobs[j].state, -1,
+           jobs[j].command);
   kill(-jobs[j].pgid, SIGTERM);
   kill(-jobs[j].pgid, SIGCONT);
 #endif /* !STUDENT */
@@ -298,9 +359,11 @@ void watchjobs(int which) {
 }
 
 /* Monitor job execution. If it gets stopped move it to background.
- * When a job has finished or has been stopped move shell to foreground. */
+ * When a job has finished or has been stopped move shell to foreground.
+ * Returns exit status of the job (128 + signal number if it was killed). */
 int monitorjob(sigset_t *mask) {
   int exitcode = 0, state;
+  long start = nanotime();
 
   /* TODO: Following code requires use of Tcsetpgrp of tty_fd. */
 #ifdef STUDENT
@@ -327,6 +390,9 @@ int monitorjob(sigset_t *mask) {
   // to dajemy je na drugi plan
   if (state == STOPPED) {
     movejob(0, allocjob());
+    exitcode = 128 + SIGTSTP;
+  } else {
+    exitcode = exitstatus(exitcode);
   }
 
   // ustawiamy shella na proces pierwszoplanowy
@@ -335,6 +401,7 @@ int monitorjob(sigset_t *mask) {
   Tcsetattr(tty_fd, TCSADRAIN, &shell_tmodes);
 #endif /* !STUDENT */
 
+  metric_observe(H_WAIT, nanotime() - start);
   return exitcode;
 }
 
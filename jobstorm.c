@@ -0,0 +1,163 @@
+#include <pty.h>
+
+#include "csapp.h"
+
+/*
+ * Load test of job control with many short-lived background jobs.
+ *
+ * Runs the shell on a pseudo-terminal and starts a number of background
+ * jobs one command line at a time. Then it keeps pressing enter until the
+ * shell has reported all of them as finished. Each command line, including
+ * the empty ones, is timed from sending it until the next prompt shows up,
+ * which tells how responsive the shell stays while SIGCHLD handler and
+ * watchjobs churn through the jobs. Time from starting the last job until
+ * all of them are reaped tells how fast the shell cleans up after them.
+ */
+
+#define TIMEOUT 30000 /* ms without any output before giving up */
+
+static int master;
+static char buf[65536];
+static size_t len = 0;
+static long nreaped = 0; /* jobs reported as finished so far */
+
+static long now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/* Count jobs reported as finished in complete lines of the buffer and drop
+ * them. Returns true if what remains is the prompt. */
+static bool scan(void) {
+  char *line = buf, *nl;
+
+  while ((nl = memchr(line, '\n', buf + len - line))) {
+    *nl = '\0';
+    if (strstr(line, "] exited '") || strstr(line, "] killed '"))
+      nreaped++;
+    line = nl + 1;
+  }
+
+  len -= line - buf;
+  memmove(buf, line, len);
+  return len == 2 && !memcmp(buf, "# ", 2);
+}
+
+static void wait_prompt(void) {
+  while (true) {
+    struct pollfd pfd = {.fd = master, .events = POLLIN};
+    if (Poll(&pfd, 1, TIMEOUT) == 0)
+      app_error("No prompt for %d seconds, %ld jobs reaped", TIMEOUT / 1000,
+                nreaped);
+    ssize_t n = read(master, buf + len, sizeof(buf) - len - 1);
+    if (n <= 0)
+      app_error("Shell is gone, %ld jobs reaped", nreaped);
+    len += n;
+    if (scan())
+      return;
+    if (len == sizeof(buf) - 1)
+      app_error("Line of output too long");
+  }
+}
+
+/* Send a line and return time until the next prompt. */
+static long command(const char *line) {
+  long start = now();
+  Write(master, line, strlen(line));
+  Write(master, "\n", 1);
+  len = 0;
+  wait_prompt();
+  return now() - start;
+}
+
+static int cmplong(const void *a, const void *b) {
+  long x = *(const long *)a, y = *(const long *)b;
+  return (x > y) - (x < y);
+}
+
+static void latency(const char *phase, long *lat, long n) {
+  if (n == 0)
+    return;
+  qsort(lat, n, sizeof(long), cmplong);
+  long sum = 0;
+  for (long i = 0; i < n; i++)
+    sum += lat[i];
+  printf("%-6s prompt latency (us): n=%ld min=%ld avg=%ld p50=%ld p90=%ld "
+         "p99=%ld max=%ld\n",
+         phase, n, lat[0] / 1000, sum / n / 1000, lat[n / 2] / 1000,
+         lat[n * 9 / 10] / 1000, lat[n * 99 / 100] / 1000, lat[n - 1] / 1000);
+}
+
+int main(int argc, char *argv[]) {
+  const char *shell = "./shell";
+  const char *cmd = "sleep 1";
+  long njobs = 1000;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:c:s:")) != -1) {
+    if (opt == 'n')
+      njobs = atol(optarg);
+    else if (opt == 'c')
+      cmd = optarg;
+    else if (opt == 's')
+      shell = optarg;
+    else
+      app_error("usage: %s [-n jobs] [-c command] [-s shell]", argv[0]);
+  }
+  if (njobs <= 0)
+    app_error("Number of jobs must be positive");
+
+  pid_t pid = forkpty(&master, NULL, NULL, NULL);
+  if (pid < 0)
+    unix_error("forkpty error");
+  if (pid == 0) {
+    execl(shell, shell, NULL);
+    unix_error("execl error");
+  }
+
+  /* Echo of command lines would only get in the way. */
+  struct termios tio;
+  Tcgetattr(master, &tio);
+  tio.c_lflag &= ~ECHO;
+  Tcsetattr(master, TCSANOW, &tio);
+  wait_prompt();
+
+  char *line = Malloc(strlen(cmd) + 3);
+  sprintf(line, "%s &", cmd);
+
+  long *start_lat = Malloc(sizeof(long) * njobs);
+  long first = now();
+  for (long i = 0; i < njobs; i++)
+    start_lat[i] = command(line);
+  long last = now();
+
+  /* Jobs are reported before the prompt once the shell has reaped them. */
+  long nprobes = 0, maxprobes = 1024;
+  long *drain_lat = Malloc(sizeof(long) * maxprobes);
+  while (nreaped < njobs) {
+    if (nprobes == maxprobes) {
+      maxprobes *= 2;
+      drain_lat = Realloc(drain_lat, sizeof(long) * maxprobes);
+    }
+    drain_lat[nprobes++] = command("");
+  }
+  long done = now();
+
+  printf("%ld jobs of '%s'\n", njobs, cmd);
+  printf("start  %.3fs, %.0f jobs/s\n", (last - first) * 1e-9,
+         njobs / ((last - first) * 1e-9));
+  printf("reap   %.3fs after the last job was started, %.3fs in total\n",
+         (done - last) * 1e-9, (done - first) * 1e-9);
+  latency("start", start_lat, njobs);
+  latency("reap", drain_lat, nprobes);
+
+  Write(master, "quit\n", 5);
+  int status;
+  Waitpid(pid, &status, 0);
+
+  free(line);
+  free(start_lat);
+  free(drain_lat);
+  return EXIT_SUCCESS;
+}
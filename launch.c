@@ -0,0 +1,231 @@
+#include <sys/syscall.h>
+
+#include "shell.h"
+#include "rio.h"
+
+#if defined(LINUX) && !defined(CLONE_PARENT)
+#define CLONE_PARENT 0x00008000 /* Linux specific, hidden without _GNU_SOURCE */
+#endif
+
+/*
+ * Launcher of external commands.
+ *
+ * Forking the shell copies page tables of its whole address space, which
+ * grows with history, variables and job table. When enabled, the shell starts
+ * a small launcher process right at the beginning of a session and sends it
+ * requests to start external commands over a socket pair. The launcher
+ * creates the process with clone(CLONE_PARENT), so it becomes a child of the
+ * shell and job control in jobs.c works as usual, and replies with its pid.
+ *
+ * A request is a header, which carries descriptors of standard input and
+ * output as ancillary data, followed by strings: working directory, path of
+ * executable, arguments, environment and command prefix assignments.
+ */
+
+typedef struct {
+  pid_t pgid;  /* process group to join, 0 to create a new one */
+  int flags;   /* see below */
+  int argc;    /* number of arguments */
+  int envc;    /* number of environment entries */
+  int nassign; /* number of prefix assignments */
+  size_t len;  /* length of strings following the header */
+} request_t;
+
+#define LR_FG 1     /* move process group to foreground */
+#define LR_INPUT 2  /* standard input is passed */
+#define LR_OUTPUT 4 /* standard output is passed */
+
+static int launcher_fd = -1; /* shell's end of the socket pair */
+static pid_t launcher_owner;  /* only the shell can use it, not subshells */
+
+#ifdef LINUX
+/* Apply prefix assignment to environment vector that has room for it.
+ * Returns new number of entries. */
+static int override(char **envp, int envc, char *assignment) {
+  size_t len = strcspn(assignment, "=") + 1;
+  int i = 0;
+
+  while (i < envc && strncmp(envp[i], assignment, len))
+    i++;
+  envp[i] = assignment;
+  if (i == envc)
+    envp[++envc] = NULL;
+  return envc;
+}
+
+static noreturn void child(request_t *req, int *fds, int tty, char *cwd,
+                           char *path, char **argv, char **envp) {
+  setpgid(0, req->pgid);
+  if (req->flags & LR_FG)
+    tcsetpgrp(tty, req->pgid ? req->pgid : getpid());
+
+  Signal(SIGINT, SIG_DFL);
+  Signal(SIGTSTP, SIG_DFL);
+  Signal(SIGTTIN, SIG_DFL);
+  Signal(SIGTTOU, SIG_DFL);
+
+  int n = 0;
+  if (req->flags & LR_INPUT)
+    dup2(fds[n++], STDIN_FILENO);
+  if (req->flags & LR_OUTPUT)
+    dup2(fds[n++], STDOUT_FILENO);
+
+  if (chdir(cwd) < 0)
+    msg("cd: %s: %s\n", cwd, strerror(errno));
+
+  metric_exec();
+  (void)execve(path, argv, envp);
+  metric_inc(M_EXECFAIL);
+  msg("%s: %s\n", argv[0], strerror(errno));
+  _exit(errno == ENOENT ? 127 : 126);
+}
+
+/* Serve requests until the shell closes its end of the socket. */
+static noreturn void serve(int sock, int tty) {
+  while (true) {
+    request_t req;
+    int fds[2], nfds = 2;
+    ssize_t n = recv_fds(sock, &req, sizeof(req), fds, &nfds);
+    if (n <= 0)
+      exit(EXIT_SUCCESS);
+    if (n < (ssize_t)sizeof(req))
+      Rio_readn(sock, (char *)&req + n, sizeof(req) - n);
+
+    char *strs = Malloc(req.len);
+    if (Rio_readn(sock, strs, req.len) < (ssize_t)req.len)
+      exit(EXIT_SUCCESS);
+
+    char *cwd = strs;
+    char *path = cwd + strlen(cwd) + 1;
+    char *s = path + strlen(path) + 1;
+
+    char **argv = Malloc(sizeof(char *) * (req.argc + 1));
+    for (int i = 0; i < req.argc; i++, s += strlen(s) + 1)
+      argv[i] = s;
+    argv[req.argc] = NULL;
+
+    char **envp = Malloc(sizeof(char *) * (req.envc + req.nassign + 1));
+    for (int i = 0; i < req.envc; i++, s += strlen(s) + 1)
+      envp[i] = s;
+    envp[req.envc] = NULL;
+
+    for (int i = 0, envc = req.envc; i < req.nassign; i++, s += strlen(s) + 1)
+      envc = override(envp, envc, s);
+
+    metric_fork();
+    pid_t pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, NULL, NULL, NULL, 0);
+    if (pid == 0)
+      child(&req, fds, tty, cwd, path, argv, envp);
+
+    for (int i = 0; i < nfds; i++)
+      Close(fds[i]);
+    free(envp);
+    free(argv);
+    free(strs);
+
+    Rio_writen(sock, &pid, sizeof(pid));
+  }
+}
+#endif
+
+/* Start launcher process, which must be done while the shell is small. */
+void launcher_start(void) {
+#ifdef LINUX
+  int sv[2];
+  Socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+  fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+
+  if (Fork() == 0) {
+    Prctl(PR_SET_PDEATHSIG, SIGKILL);
+    Close(sv[0]);
+    fcntl(sv[1], F_SETFD, FD_CLOEXEC);
+
+    int tty = Dup(STDIN_FILENO);
+    fcntl(tty, F_SETFD, FD_CLOEXEC);
+
+    /* Stay out of the way of job control just like the shell. */
+    Signal(SIGINT, SIG_IGN);
+    Signal(SIGTSTP, SIG_IGN);
+    Signal(SIGTTIN, SIG_IGN);
+    Signal(SIGTTOU, SIG_IGN);
+
+    serve(sv[1], tty);
+  }
+
+  Close(sv[1]);
+  launcher_fd = sv[0];
+  launcher_owner = getpid();
+#endif
+}
+
+static void strput(char **bufp, const char *s) {
+  size_t len = strlen(s) + 1;
+  memcpy(*bufp, s, len);
+  *bufp += len;
+}
+
+/* Start external command with the launcher. The process joins group `pgid`
+ * or creates a new one if it's 0. Returns pid of the process, or -1 if the
+ * launcher is not running, or the command is a builtin, a function or cannot
+ * be found, in which case the caller must fork by itself. */
+pid_t launch(char **argv, char **assign, int nassign, int input, int output,
+             pid_t pgid, bool fg) {
+  const char *path = argv[0];
+  char cwd[PATH_MAX];
+
+  if (launcher_fd < 0 || getpid() != launcher_owner)
+    return -1;
+
+  if (!index(path, '/')) {
+    atom_t *a = atom(path);
+    if (a == NULL || a->builtin || a->func || a->path == NULL)
+      return -1;
+    path = a->path;
+  }
+
+  if (getcwd(cwd, sizeof(cwd)) == NULL)
+    return -1;
+
+  request_t req = {.pgid = pgid, .flags = fg ? LR_FG : 0};
+  int fds[2], nfds = 0;
+
+  if (input >= 0) {
+    req.flags |= LR_INPUT;
+    fds[nfds++] = input;
+  }
+  if (output >= 0) {
+    req.flags |= LR_OUTPUT;
+    fds[nfds++] = output;
+  }
+
+  req.len = strlen(cwd) + strlen(path) + 2;
+  for (; argv[req.argc]; req.argc++)
+    req.len += strlen(argv[req.argc]) + 1;
+  for (; environ[req.envc]; req.envc++)
+    req.len += strlen(environ[req.envc]) + 1;
+  for (; req.nassign < nassign; req.nassign++)
+    req.len += strlen(assign[req.nassign]) + 1;
+
+  char *strs = Malloc(req.len), *s = strs;
+  strput(&s, cwd);
+  strput(&s, path);
+  for (int i = 0; i < req.argc; i++)
+    strput(&s, argv[i]);
+  for (int i = 0; i < req.envc; i++)
+    strput(&s, environ[i]);
+  for (int i = 0; i < nassign; i++)
+    strput(&s, assign[i]);
+
+  pid_t pid = -1;
+  if (send_fds(launcher_fd, &req, sizeof(req), fds, nfds) < 0 ||
+      rio_writen(launcher_fd, strs, req.len) < 0 ||
+      rio_readn(launcher_fd, &pid, sizeof(pid)) < (ssize_t)sizeof(pid)) {
+    msg("launcher: %s\n", strerror(errno));
+    pid = -1;
+    Close(launcher_fd);
+    launcher_fd = -1;
+  }
+
+  free(strs);
+  return pid;
+}
@@ -12,6 +12,29 @@ void strapp(char **dstp, const char *src) {
   }
 }
 
+/* Returns length of word at `s`. Parentheses of "$(...)" and "$((...))" are
+ * matched, so that expression inside may contain spaces and operators. */
+static size_t wordlen(const char *s) {
+  size_t n = 0;
+
+  while (s[n] && !strchr(" |&<>;", s[n])) {
+    if (s[n] == '$' && s[n + 1] == '(') {
+      for (int depth = 0; s[++n];) {
+        if (s[n] == '(') {
+          depth++;
+        } else if (s[n] == ')' && --depth == 0) {
+          n++;
+          break;
+        }
+      }
+    } else {
+      n++;
+    }
+  }
+
+  return n;
+}
+
 token_t *tokenize(char *s, int *tokc_p) {
   int capacity = 10;
   int ntoks = 0;
@@ -31,8 +54,9 @@ token_t *tokenize(char *s, int *tokc_p) {
       tokvec = realloc(tokvec, sizeof(token_t) * (capacity + 1));
     }
 
-    size_t l = strcspn(s, " |&<>;!");
-    if (l > 0) {
+    /* Exclamation mark is an operator only if it's a separate word. */
+    size_t l = wordlen(s);
+    if (l > 0 && !(l == 1 && s[0] == '!')) {
       tokvec[ntoks++] = s;
       s += l;
       continue;
@@ -55,9 +79,19 @@ token_t *tokenize(char *s, int *tokc_p) {
         tok = T_BGJOB;
       }
     } else if (s[0] == '<') {
-      tok = T_INPUT;
+      if (s[1] == '&') {
+        *s++ = 0;
+        tok = T_DUPIN;
+      } else {
+        tok = T_INPUT;
+      }
     } else if (s[0] == '>') {
-      tok = T_OUTPUT;
+      if (s[1] == '&') {
+        *s++ = 0;
+        tok = T_DUPOUT;
+      } else {
+        tok = T_OUTPUT;
+      }
     } else if (s[0] == ';') {
       tok = T_COLON;
     } else if (s[0] == '!') {
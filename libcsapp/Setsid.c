@@ -0,0 +1,8 @@
+#include "csapp.h"
+
+pid_t Setsid(void) {
+  pid_t rc = setsid();
+  if (rc < 0)
+    unix_error("Setsid error");
+  return rc;
+}
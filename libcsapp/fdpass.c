@@ -0,0 +1,90 @@
+#include "csapp.h"
+
+/*
+ * send_fds - Send len bytes of buf along with nfds file descriptors over
+ *     UNIX domain socket. Data must not be empty, since descriptors travel
+ *     as ancillary data of a regular message.
+ *
+ *     On error, returns -1 with errno set.
+ */
+
+ssize_t send_fds(int sock, const void *buf, size_t len, const int *fds,
+                 int nfds) {
+  struct iovec iov = {.iov_base = (void *)buf, .iov_len = len};
+  union {
+    struct cmsghdr hdr;
+    char buf[CMSG_SPACE(sizeof(int) * MAXFDPASS)];
+  } u;
+
+  assert(len > 0 && nfds >= 0 && nfds <= MAXFDPASS);
+
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = u.buf,
+    .msg_controllen = CMSG_SPACE(sizeof(int) * nfds),
+  };
+
+  if (nfds == 0) {
+    msg.msg_control = NULL;
+    msg.msg_controllen = 0;
+  } else {
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+  }
+
+  return sendmsg(sock, &msg, 0);
+}
+
+/*
+ * recv_fds - Receive message sent by send_fds. At most *nfdsp descriptors
+ *     are stored in fds, and *nfdsp is set to the number received. Received
+ *     descriptors have close-on-exec flag set.
+ *
+ *     Returns number of bytes received, or -1 with errno set on error.
+ */
+
+ssize_t recv_fds(int sock, void *buf, size_t len, int *fds, int *nfdsp) {
+  struct iovec iov = {.iov_base = buf, .iov_len = len};
+  union {
+    struct cmsghdr hdr;
+    char buf[CMSG_SPACE(sizeof(int) * MAXFDPASS)];
+  } u;
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = u.buf,
+    .msg_controllen = sizeof(u.buf),
+  };
+  ssize_t n;
+
+  assert(*nfdsp >= 0 && *nfdsp <= MAXFDPASS);
+
+  do {
+    n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+  } while (n < 0 && errno == EINTR);
+
+  if (n < 0)
+    return -1;
+
+  int nfds = 0;
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+      continue;
+    int *passed = (int *)CMSG_DATA(cmsg);
+    int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (int i = 0; i < count; i++) {
+      if (nfds < *nfdsp)
+        fds[nfds++] = passed[i];
+      else
+        close(passed[i]);
+    }
+  }
+
+  *nfdsp = nfds;
+  return n;
+}
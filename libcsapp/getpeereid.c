@@ -0,0 +1,26 @@
+#include "csapp.h"
+
+#ifdef LINUX
+/*
+ * getpeereid - Get effective user and group id of process on the other end
+ *     of connected UNIX domain socket, as BSD systems do.
+ *
+ *     On error, returns -1 with errno set.
+ */
+
+int getpeereid(int sock, uid_t *euid, gid_t *egid) {
+  /* Layout of struct ucred, which is hidden without _GNU_SOURCE */
+  struct {
+    pid_t pid;
+    uid_t uid;
+    gid_t gid;
+  } cred;
+  socklen_t len = sizeof(cred);
+
+  if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+    return -1;
+  *euid = cred.uid;
+  *egid = cred.gid;
+  return 0;
+}
+#endif
@@ -585,3 +585,12 @@ uint32_t jenkins_hash(const void *key, size_t length, uint32_t initval) {
   return c;
 }
 #endif
+
+/* jenkins_hash reads whole words, possibly past the end of the key, so hash
+ * a zero-padded copy of the string. */
+uint32_t jenkins_strhash(const char *s, size_t length) {
+  uint32_t buf[length / 4 + 1];
+  memset(buf, 0, sizeof(buf));
+  memcpy(buf, s, length);
+  return jenkins_hash(buf, length, HASHINIT);
+}
@@ -1,15 +1,16 @@
 #include "csapp.h"
 
 /*
- * open_listenfd - Open and return a listening socket on port. This
- *     function is reentrant and protocol-independent.
+ * open_hostlistenfd - Open and return a listening socket on port of given
+ *     local address, or any address if host is NULL. This function is
+ *     reentrant and protocol-independent.
  *
  *     On error, returns:
  *       -2 for getaddrinfo error
  *       -1 with errno set for other errors.
  */
 
-int open_listenfd(char *port, int backlog) {
+int open_hostlistenfd(char *host, char *port, int backlog) {
   struct addrinfo hints, *listp, *p;
   int listenfd, rc, optval = 1;
 
@@ -18,9 +19,9 @@ int open_listenfd(char *port, int backlog) {
   hints.ai_socktype = SOCK_STREAM;             /* Accept connections */
   hints.ai_flags = AI_PASSIVE | AI_ADDRCONFIG; /* ... on any IP address */
   hints.ai_flags |= AI_NUMERICSERV;            /* ... using port number */
-  if ((rc = getaddrinfo(NULL, port, &hints, &listp)) != 0) {
-    fprintf(stderr, "getaddrinfo failed (port %s): %s\n", port,
-            gai_strerror(rc));
+  if ((rc = getaddrinfo(host, port, &hints, &listp)) != 0) {
+    fprintf(stderr, "getaddrinfo failed (%s:%s): %s\n", host ? host : "*",
+            port, gai_strerror(rc));
     return -2;
   }
 
@@ -56,6 +57,22 @@ int open_listenfd(char *port, int backlog) {
   return listenfd;
 }
 
+int Open_hostlistenfd(char *host, char *port, int backlog) {
+  int rc = open_hostlistenfd(host, port, backlog);
+
+  if (rc < 0)
+    unix_error("Open_hostlistenfd error");
+  return rc;
+}
+
+/*
+ * open_listenfd - Open and return a listening socket on port of any address.
+ */
+
+int open_listenfd(char *port, int backlog) {
+  return open_hostlistenfd(NULL, port, backlog);
+}
+
 int Open_listenfd(char *port, int backlog) {
   int rc = open_listenfd(port, backlog);
 
@@ -0,0 +1,38 @@
+#include "csapp.h"
+
+/*
+ * open_unix_clientfd - Open connection to server listening on UNIX domain
+ *     socket at path and return a socket descriptor ready for reading and
+ *     writing.
+ *
+ *     On error, returns -1 with errno set.
+ */
+
+int open_unix_clientfd(char *path) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  int clientfd;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  if ((clientfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    return -1;
+
+  if (connect(clientfd, (SA *)&addr, sizeof(addr)) < 0) {
+    int error = errno;
+    close(clientfd);
+    errno = error;
+    return -1;
+  }
+  return clientfd;
+}
+
+int Open_unix_clientfd(char *path) {
+  int rc = open_unix_clientfd(path);
+  if (rc < 0)
+    unix_error("Open_unix_clientfd error");
+  return rc;
+}
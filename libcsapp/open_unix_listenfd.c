@@ -0,0 +1,45 @@
+#include "csapp.h"
+
+/*
+ * open_unix_listenfd - Open and return a listening socket bound to UNIX
+ *     domain socket at path. Stale socket left by a previous server at the
+ *     same path is removed, but any other kind of file is left alone.
+ *
+ *     On error, returns -1 with errno set.
+ */
+
+int open_unix_listenfd(char *path, int backlog) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  struct stat sb;
+  int listenfd;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  if ((listenfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    return -1;
+
+  /* Equivalent of SO_REUSEADDR for UNIX domain sockets */
+  if (lstat(path, &sb) == 0 && S_ISSOCK(sb.st_mode))
+    (void)unlink(path);
+
+  if (bind(listenfd, (SA *)&addr, sizeof(addr)) < 0 ||
+      listen(listenfd, backlog) < 0) {
+    int error = errno;
+    close(listenfd);
+    errno = error;
+    return -1;
+  }
+  return listenfd;
+}
+
+int Open_unix_listenfd(char *path, int backlog) {
+  int rc = open_unix_listenfd(path, backlog);
+
+  if (rc < 0)
+    unix_error("Open_unix_listenfd error");
+  return rc;
+}
@@ -19,8 +19,8 @@ static char *print_num(char *nbuf, uintmax_t num, int base, int *len_p) {
   return p;
 }
 
-static int safe_vprintf(int fd, const char *fmt, va_list ap) {
-  char line[LINELEN];
+/* Format string into line of given size. Returns its length. */
+static int safe_vformat(char *line, int size, const char *fmt, va_list ap) {
   char nbuf[MAXNBUF];
   int linelen = 0;
   int stop = 0;
@@ -28,7 +28,7 @@ static int safe_vprintf(int fd, const char *fmt, va_list ap) {
 #define PCHAR(c)                                                               \
   {                                                                            \
     int _c = (c);                                                              \
-    if (linelen < MAXLINE)                                                     \
+    if (linelen < size)                                                        \
       line[linelen++] = _c;                                                    \
   }
 
@@ -116,7 +116,22 @@ static int safe_vprintf(int fd, const char *fmt, va_list ap) {
 #undef PCHAR
 
 print:
-  return write(fd, line, linelen);
+  return linelen;
+}
+
+static int safe_vprintf(int fd, const char *fmt, va_list ap) {
+  char line[LINELEN];
+  return write(fd, line, safe_vformat(line, LINELEN, fmt, ap));
+}
+
+/* Like snprintf(3), but truncated output is not counted in returned length. */
+int safe_snprintf(char *buf, size_t size, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  int len = safe_vformat(buf, size - 1, fmt, ap);
+  va_end(ap);
+  buf[len] = '\0';
+  return len;
 }
 
 void safe_printf(const char *fmt, ...) {
@@ -0,0 +1,222 @@
+#include <stdatomic.h>
+
+#include "csapp.h"
+#include "threadpool.h"
+
+#define DEQUE_INITSIZE 64 /* must be a power of two */
+
+typedef struct {
+  task_fn_t fn;
+  void *arg;
+} task_t;
+
+typedef struct {
+  threadpool_t *pool;
+  pthread_t tid;
+  int index;
+  pthread_mutex_t lock; /* protects the deque */
+  task_t *tasks;        /* ring buffer, its size is a power of two */
+  unsigned size;
+  unsigned top;    /* the oldest task, taken by thieves */
+  unsigned bottom; /* just past the newest task, taken by the owner */
+} worker_t;
+
+struct threadpool {
+  worker_t *workers;
+  int nworkers;
+  atomic_int queued;    /* number of tasks in deques */
+  atomic_int pending;   /* number of tasks submitted but not finished */
+  atomic_int nidle;     /* number of workers parked or about to park */
+  bool shutdown;        /* threads should exit */
+  pthread_mutex_t lock; /* protects parking */
+  pthread_cond_t cond;
+};
+
+/* Worker run by current thread. */
+static _Thread_local worker_t *self = NULL;
+
+static void push(worker_t *w, task_t t) {
+  Pthread_mutex_lock(&w->lock);
+  if (w->bottom - w->top == w->size) {
+    /* Tasks keep their indices modulo the new size. */
+    task_t *tasks = Malloc(sizeof(task_t) * w->size * 2);
+    for (unsigned i = w->top; i != w->bottom; i++)
+      tasks[i & (w->size * 2 - 1)] = w->tasks[i & (w->size - 1)];
+    free(w->tasks);
+    w->tasks = tasks;
+    w->size *= 2;
+  }
+  w->tasks[w->bottom++ & (w->size - 1)] = t;
+  Pthread_mutex_unlock(&w->lock);
+}
+
+static bool pop(worker_t *w, task_t *tp) {
+  bool found = false;
+  Pthread_mutex_lock(&w->lock);
+  if (w->bottom != w->top) {
+    *tp = w->tasks[--w->bottom & (w->size - 1)];
+    found = true;
+  }
+  Pthread_mutex_unlock(&w->lock);
+  return found;
+}
+
+static bool steal(worker_t *w, task_t *tp) {
+  bool found = false;
+  Pthread_mutex_lock(&w->lock);
+  if (w->bottom != w->top) {
+    *tp = w->tasks[w->top++ & (w->size - 1)];
+    found = true;
+  }
+  Pthread_mutex_unlock(&w->lock);
+  return found;
+}
+
+/* Take a task from own deque, or steal one from other workers. */
+static bool find(worker_t *w, task_t *tp) {
+  threadpool_t *pool = w->pool;
+  int n = pool->nworkers;
+
+  if (atomic_load(&pool->queued) == 0)
+    return false;
+
+  bool found = pop(w, tp);
+  for (int k = 1; !found && k < n; k++)
+    found = steal(&pool->workers[(w->index + k) % n], tp);
+
+  if (found)
+    atomic_fetch_sub(&pool->queued, 1);
+  return found;
+}
+
+static void run(threadpool_t *pool, task_t t) {
+  t.fn(t.arg);
+
+  if (atomic_fetch_sub(&pool->pending, 1) == 1) {
+    Pthread_mutex_lock(&pool->lock);
+    Pthread_cond_broadcast(&pool->cond);
+    Pthread_mutex_unlock(&pool->lock);
+  }
+}
+
+/* Sleep until there are tasks to take. A waiting worker also wakes up when
+ * all tasks are done. Returns true if the pool is being shut down. */
+static bool park(threadpool_t *pool, bool waiting) {
+  Pthread_mutex_lock(&pool->lock);
+  /* Submitter checks `nidle` after bumping `queued`, so either it sees us
+   * here or we see its task below. */
+  atomic_fetch_add(&pool->nidle, 1);
+  while (atomic_load(&pool->queued) == 0 && !pool->shutdown &&
+         !(waiting && atomic_load(&pool->pending) == 0))
+    Pthread_cond_wait(&pool->cond, &pool->lock);
+  atomic_fetch_sub(&pool->nidle, 1);
+  bool shutdown = pool->shutdown;
+  Pthread_mutex_unlock(&pool->lock);
+  return shutdown;
+}
+
+static void *worker(void *arg) {
+  worker_t *w = arg;
+  task_t t;
+
+  self = w;
+
+  while (true) {
+    if (find(w, &t))
+      run(w->pool, t);
+    else if (park(w->pool, false) && atomic_load(&w->pool->queued) == 0)
+      break;
+  }
+
+  return NULL;
+}
+
+threadpool_t *threadpool_create(int nworkers) {
+  if (nworkers <= 0)
+    nworkers = max(sysconf(_SC_NPROCESSORS_ONLN), 1L);
+
+  threadpool_t *pool = Calloc(1, sizeof(threadpool_t));
+  pool->workers = Calloc(nworkers, sizeof(worker_t));
+  pool->nworkers = nworkers;
+  Pthread_mutex_init(&pool->lock, NULL);
+  Pthread_cond_init(&pool->cond, NULL);
+
+  for (int i = 0; i < nworkers; i++) {
+    worker_t *w = &pool->workers[i];
+    w->pool = pool;
+    w->index = i;
+    w->size = DEQUE_INITSIZE;
+    w->tasks = Malloc(sizeof(task_t) * w->size);
+    Pthread_mutex_init(&w->lock, NULL);
+  }
+
+  /* Signals must be delivered to the main thread only. */
+  sigset_t all, mask;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &mask);
+  for (int i = 1; i < nworkers; i++)
+    Pthread_create(&pool->workers[i].tid, NULL, worker, &pool->workers[i]);
+  pthread_sigmask(SIG_SETMASK, &mask, NULL);
+
+  return pool;
+}
+
+void threadpool_destroy(threadpool_t *pool) {
+  threadpool_wait(pool);
+
+  Pthread_mutex_lock(&pool->lock);
+  pool->shutdown = true;
+  Pthread_cond_broadcast(&pool->cond);
+  Pthread_mutex_unlock(&pool->lock);
+
+  for (int i = 1; i < pool->nworkers; i++)
+    Pthread_join(pool->workers[i].tid, NULL);
+
+  for (int i = 0; i < pool->nworkers; i++) {
+    Pthread_mutex_destroy(&pool->workers[i].lock);
+    free(pool->workers[i].tasks);
+  }
+
+  Pthread_cond_destroy(&pool->cond);
+  Pthread_mutex_destroy(&pool->lock);
+  free(pool->workers);
+  free(pool);
+}
+
+void threadpool_submit(threadpool_t *pool, task_fn_t fn, void *arg) {
+  worker_t *w = (self && self->pool == pool) ? self : &pool->workers[0];
+
+  atomic_fetch_add(&pool->pending, 1);
+  push(w, (task_t){.fn = fn, .arg = arg});
+  atomic_fetch_add(&pool->queued, 1);
+
+  if (atomic_load(&pool->nidle) > 0) {
+    Pthread_mutex_lock(&pool->lock);
+    Pthread_cond_signal(&pool->cond);
+    Pthread_mutex_unlock(&pool->lock);
+  }
+}
+
+void threadpool_wait(threadpool_t *pool) {
+  worker_t *prev = self;
+  task_t t;
+
+  self = &pool->workers[0];
+
+  while (atomic_load(&pool->pending) > 0) {
+    if (find(self, &t))
+      run(pool, t);
+    else
+      park(pool, true);
+  }
+
+  self = prev;
+}
+
+int threadpool_size(threadpool_t *pool) {
+  return pool->nworkers;
+}
+
+int threadpool_self(threadpool_t *pool) {
+  return (self && self->pool == pool) ? self->index : 0;
+}
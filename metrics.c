@@ -0,0 +1,280 @@
+#include "shell.h"
+
+/*
+ * Metrics endpoint.
+ *
+ * With "--metrics [ADDR:]PORT" the shell serves counters, gauges and
+ * histograms in Prometheus text format over HTTP, on loopback interface
+ * unless told otherwise. Some of them are bumped by forked
+ * children right before and after they call execve, so all of them live in
+ * a shared anonymous page inherited by every process the shell starts.
+ *
+ * Shell's main thread is blocked in readline or sigsuspend most of the time,
+ * so connections are handled by a thread of its own running a poll loop.
+ * The thread must not take any locks that a forked child could need, hence
+ * responses are formatted with signal safe functions into a fixed buffer.
+ */
+
+#define NCLIENTS 8
+#define REQSIZE 1024
+#define RESPSIZE 8192
+#define NBUCKETS 10
+
+typedef struct {
+  uint64_t bucket[NBUCKETS]; /* observations not greater than bound */
+  uint64_t count;
+  uint64_t sum_ns;
+} hist_t;
+
+typedef struct {
+  uint64_t count[M_COUNT];
+  int jobs[STOPPED + 1]; /* number of jobs in each state */
+  hist_t hist[H_COUNT];
+} metrics_t;
+
+static const struct {
+  const char *name, *help;
+} counters[M_COUNT] = {
+  [M_FORK] = {"shell_forks_total", "Processes forked by the shell."},
+  [M_EXEC] = {"shell_execs_total", "Calls to execve made by children."},
+  [M_PROBE] = {"shell_path_probes_total",
+               "Candidate locations of commands tried while searching PATH."},
+  [M_EXECFAIL] = {"shell_exec_failures_total",
+                  "Children that failed to execute a command."},
+};
+
+static const struct {
+  const char *name, *help;
+  long bound[NBUCKETS]; /* upper bounds in nanoseconds */
+  const char *le[NBUCKETS];
+} hists[H_COUNT] = {
+  [H_FORKEXEC] = {"shell_fork_exec_seconds",
+                  "Time from fork to the first execve in the child.",
+                  {10000, 25000, 50000, 100000, 250000, 500000, 1000000,
+                   2500000, 5000000, 10000000},
+                  {"1e-05", "2.5e-05", "5e-05", "0.0001", "0.00025", "0.0005",
+                   "0.001", "0.0025", "0.005", "0.01"}},
+  [H_WAIT] = {"shell_monitorjob_wait_seconds",
+              "Time the shell spent waiting for a foreground job.",
+              {1000000, 5000000, 10000000, 50000000, 100000000, 500000000,
+               1000000000, 5000000000, 10000000000, 60000000000},
+              {"0.001", "0.005", "0.01", "0.05", "0.1", "0.5", "1", "5", "10",
+               "60"}},
+};
+
+static const char *jobstates[] = {
+  [FINISHED] = "finished", [RUNNING] = "running", [STOPPED] = "stopped"};
+
+static metrics_t *metrics = NULL;
+static long forked_at; /* inherited by the child */
+
+long nanotime(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+void metric_inc(int counter) {
+  if (metrics)
+    __atomic_add_fetch(&metrics->count[counter], 1, __ATOMIC_RELAXED);
+}
+
+void metric_observe(int hist, long ns) {
+  if (metrics == NULL)
+    return;
+
+  /* Count goes first, so that a reader never sees buckets ahead of it. */
+  hist_t *h = &metrics->hist[hist];
+  __atomic_add_fetch(&h->count, 1, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&h->sum_ns, ns, __ATOMIC_RELAXED);
+  for (int i = 0; i < NBUCKETS; i++)
+    if (ns <= hists[hist].bound[i])
+      __atomic_add_fetch(&h->bucket[i], 1, __ATOMIC_RELAXED);
+}
+
+/* Call right before fork. */
+void metric_fork(void) {
+  if (metrics == NULL)
+    return;
+  metric_inc(M_FORK);
+  forked_at = nanotime();
+}
+
+/* Call in the child right before execve. */
+void metric_exec(void) {
+  if (metrics == NULL)
+    return;
+  metric_inc(M_EXEC);
+  if (forked_at) {
+    metric_observe(H_FORKEXEC, nanotime() - forked_at);
+    forked_at = 0;
+  }
+}
+
+/* Update number of jobs in each state. Safe to call from signal handlers. */
+void metric_jobs(int running, int stopped, int finished) {
+  if (metrics == NULL)
+    return;
+  __atomic_store_n(&metrics->jobs[RUNNING], running, __ATOMIC_RELAXED);
+  __atomic_store_n(&metrics->jobs[STOPPED], stopped, __ATOMIC_RELAXED);
+  __atomic_store_n(&metrics->jobs[FINISHED], finished, __ATOMIC_RELAXED);
+}
+
+static uint64_t load(uint64_t *p) {
+  return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+#define APPEND(...)                                                            \
+  len += safe_snprintf(buf + len, size - len, __VA_ARGS__)
+
+static size_t format(char *buf, size_t size) {
+  size_t len = 0;
+
+  for (int i = 0; i < M_COUNT; i++) {
+    APPEND("# HELP %s %s\n# TYPE %s counter\n%s %ld\n", counters[i].name,
+           counters[i].help, counters[i].name, counters[i].name,
+           (long)load(&metrics->count[i]));
+  }
+
+  APPEND("# HELP shell_jobs Jobs known to the shell by state, finished ones "
+         "are waiting to be reported.\n# TYPE shell_jobs gauge\n");
+  for (int i = FINISHED; i <= STOPPED; i++)
+    APPEND("shell_jobs{state=\"%s\"} %d\n", jobstates[i],
+           __atomic_load_n(&metrics->jobs[i], __ATOMIC_RELAXED));
+
+  for (int i = 0; i < H_COUNT; i++) {
+    const char *name = hists[i].name;
+    hist_t *h = &metrics->hist[i];
+    long bucket[NBUCKETS];
+    for (int j = 0; j < NBUCKETS; j++)
+      bucket[j] = load(&h->bucket[j]);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long count = load(&h->count);
+    long sum = load(&h->sum_ns);
+    APPEND("# HELP %s %s\n# TYPE %s histogram\n", name, hists[i].help, name);
+    for (int j = 0; j < NBUCKETS; j++)
+      APPEND("%s_bucket{le=\"%s\"} %ld\n", name, hists[i].le[j], bucket[j]);
+    APPEND("%s_bucket{le=\"+Inf\"} %ld\n", name, count);
+    /* Signal safe formatting has no field width, so pad by hand. */
+    char frac[10];
+    for (int k = 8, ns = sum % 1000000000; k >= 0; k--, ns /= 10)
+      frac[k] = '0' + ns % 10;
+    frac[9] = '\0';
+    APPEND("%s_sum %ld.%s\n%s_count %ld\n", name, sum / 1000000000, frac,
+           name, count);
+  }
+
+  return len;
+}
+
+#undef APPEND
+
+typedef struct {
+  int fd;
+  size_t len;
+  char req[REQSIZE];
+} client_t;
+
+/* Reply once the whole request header has arrived. Returns true if the
+ * connection is done with. */
+static bool respond(client_t *c) {
+  ssize_t n = read(c->fd, c->req + c->len, REQSIZE - 1 - c->len);
+  if (n <= 0)
+    return n == 0 || (errno != EINTR && errno != EAGAIN);
+  c->len += n;
+  c->req[c->len] = '\0';
+  if (!strstr(c->req, "\r\n\r\n") && c->len < REQSIZE - 1)
+    return false;
+
+  static char body[RESPSIZE];
+  char head[256];
+  size_t blen = 0, hlen;
+
+  if (!strncmp(c->req, "GET /metrics ", 13)) {
+    blen = format(body, sizeof(body));
+    hlen = safe_snprintf(
+      head, sizeof(head),
+      "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+      "Content-Length: %ld\r\nConnection: close\r\n\r\n",
+      (long)blen);
+  } else {
+    hlen = safe_snprintf(head, sizeof(head),
+                         "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n"
+                         "Connection: close\r\n\r\n");
+  }
+
+  struct iovec iov[2] = {{head, hlen}, {body, blen}};
+  (void)writev(c->fd, iov, 2);
+  return true;
+}
+
+static void *serve(void *arg) {
+  int listenfd = (intptr_t)arg;
+  client_t clients[NCLIENTS];
+  struct pollfd fds[NCLIENTS + 1];
+  int nclients = 0;
+
+  while (true) {
+    /* Stop accepting connections while all slots are taken. */
+    fds[0] = (struct pollfd){.fd = listenfd,
+                             .events = nclients < NCLIENTS ? POLLIN : 0};
+    for (int i = 0; i < nclients; i++)
+      fds[i + 1] = (struct pollfd){.fd = clients[i].fd, .events = POLLIN};
+
+    if (poll(fds, nclients + 1, -1) < 0)
+      continue;
+
+    for (int i = nclients - 1; i >= 0; i--) {
+      if (fds[i + 1].revents && respond(&clients[i])) {
+        close(clients[i].fd);
+        clients[i] = clients[--nclients];
+      }
+    }
+
+    if (fds[0].revents & POLLIN) {
+      int fd = accept(listenfd, NULL, NULL);
+      if (fd >= 0) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        clients[nclients++] = (client_t){.fd = fd};
+      }
+    }
+  }
+
+  return NULL;
+}
+
+/* Start serving metrics on given port, optionally preceded by address, which
+ * may be "*" for all of them. Must be called before any process is started,
+ * so that all of them share the counters. */
+void metrics_open(char *addr) {
+  metrics = Mmap(NULL, sizeof(metrics_t), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+  char host[NI_MAXHOST] = "127.0.0.1";
+  char *port = addr, *colon = rindex(addr, ':');
+  if (colon) {
+    /* IPv6 address may be bracketed to tell it apart from the port. */
+    char *start = addr;
+    size_t len = colon - addr;
+    if (len >= 2 && addr[0] == '[' && colon[-1] == ']')
+      start++, len -= 2;
+    if (len >= sizeof(host))
+      app_error("--metrics: %s: address too long", addr);
+    memcpy(host, start, len);
+    host[len] = '\0';
+    port = colon + 1;
+  }
+
+  int listenfd =
+    Open_hostlistenfd(strcmp(host, "*") ? host : NULL, port, 16);
+  fcntl(listenfd, F_SETFD, FD_CLOEXEC);
+
+  /* Signals must be delivered to the main thread only. */
+  sigset_t all, mask;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &mask);
+  pthread_t tid;
+  Pthread_create(&tid, NULL, serve, (void *)(intptr_t)listenfd);
+  Pthread_detach(tid);
+  pthread_sigmask(SIG_SETMASK, &mask, NULL);
+}
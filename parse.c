@@ -0,0 +1,347 @@
+#include "shell.h"
+
+/*
+ * Recursive descent parser building syntax tree of a command line:
+ *
+ *   list     := andor ((';' | '&') andor)* [';' | '&']
+ *   andor    := pipeline (('&&' | '||') pipeline)*
+ *   pipeline := ['!'] (compound | command ('|' command)*)
+ *   compound := 'if' list 'then' list ('elif' list 'then' list)*
+ *                 ['else' list] 'fi'
+ *             | ('while' | 'until') list 'do' list 'done'
+ *             | 'for' NAME ['in' word* ';'] 'do' list 'done'
+ *             | '{' list '}'
+ *             | NAME '()' compound
+ *
+ * Leaves of the tree refer to ranges of tokens that describe a simple command
+ * or a pipeline, including redirections, and are executed as a single job.
+ * Reserved words are recognized only where a command starts.
+ */
+
+typedef struct {
+  token_t *token; /* token vector being parsed */
+  int ntokens;    /* number of tokens in the vector */
+  int pos;        /* index of the first token not consumed yet */
+} parser_t;
+
+static const char *tokname(token_t tok) {
+  static const char *names[] = {
+    [0] = "newline", [1] = "&&", [2] = "||", [3] = "|", [4] = "&",
+    [5] = ";",       [6] = ">",  [7] = "<",  [8] = ">>", [9] = "!",
+    [10] = ">&",     [11] = "<&",
+  };
+  return string_p(tok) ? tok : names[(intptr_t)tok];
+}
+
+static node_t *mknode(int type, node_t *left, node_t *right) {
+  node_t *n = Malloc(sizeof(node_t));
+  n->type = type;
+  n->left = left;
+  n->right = right;
+  n->alt = NULL;
+  n->name = NULL;
+  n->token = NULL;
+  n->ntokens = 0;
+  n->bg = false;
+  return n;
+}
+
+void freenode(node_t *n) {
+  if (n == NULL)
+    return;
+  freenode(n->left);
+  freenode(n->right);
+  freenode(n->alt);
+  free(n);
+}
+
+static node_t *syntax_error(parser_t *p) {
+  token_t tok = p->pos < p->ntokens ? p->token[p->pos] : T_NULL;
+  msg("syntax error near unexpected token '%s'\n", tokname(tok));
+  return NULL;
+}
+
+static inline token_t peek(parser_t *p) {
+  return p->pos < p->ntokens ? p->token[p->pos] : T_NULL;
+}
+
+/* Is the next token given reserved word? */
+static bool keyword(parser_t *p, const char *word) {
+  token_t tok = peek(p);
+  return string_p(tok) && !strcmp(tok, word);
+}
+
+static bool expect(parser_t *p, const char *word) {
+  if (!keyword(p, word))
+    return false;
+  p->pos++;
+  return true;
+}
+
+/* Words that end a list nested in a compound command. */
+static bool terminator_p(parser_t *p) {
+  static const char *words[] = {"then", "elif", "else", "fi",
+                                "do",   "done", "}",    NULL};
+  for (const char **w = words; *w; w++)
+    if (keyword(p, *w))
+      return true;
+  return false;
+}
+
+/* Returns length of function name if token is "NAME()", or "NAME" followed by
+ * "()" token, and 0 otherwise. */
+static size_t fundef_p(parser_t *p) {
+  token_t tok = peek(p);
+  if (!string_p(tok))
+    return 0;
+  size_t len = varnamelen(tok);
+  if (len == 0)
+    return 0;
+  if (!strcmp(tok + len, "()"))
+    return len;
+  if (tok[len] == '\0' && p->pos + 1 < p->ntokens &&
+      string_p(p->token[p->pos + 1]) && !strcmp(p->token[p->pos + 1], "()"))
+    return len;
+  return 0;
+}
+
+static node_t *parse_list(parser_t *p);
+static node_t *parse_compound(parser_t *p);
+
+/* Parse a list that must be followed by given reserved word. */
+static node_t *parse_body(parser_t *p, const char *end) {
+  node_t *n = parse_list(p);
+  if (n == NULL)
+    return NULL;
+  if (!expect(p, end)) {
+    freenode(n);
+    return syntax_error(p);
+  }
+  return n;
+}
+
+static node_t *parse_if(parser_t *p) {
+  node_t *cond = parse_body(p, "then");
+  if (cond == NULL)
+    return NULL;
+
+  node_t *n = mknode(N_IF, cond, NULL);
+
+  if (!(n->right = parse_list(p))) {
+    freenode(n);
+    return NULL;
+  }
+
+  if (expect(p, "elif")) {
+    n->alt = parse_if(p);
+  } else if (expect(p, "else")) {
+    n->alt = parse_body(p, "fi");
+  } else if (expect(p, "fi")) {
+    return n;
+  } else {
+    syntax_error(p);
+  }
+
+  if (n->alt == NULL) {
+    freenode(n);
+    return NULL;
+  }
+  return n;
+}
+
+static node_t *parse_while(parser_t *p, int type) {
+  node_t *cond = parse_body(p, "do");
+  if (cond == NULL)
+    return NULL;
+
+  node_t *body = parse_body(p, "done");
+  if (body == NULL) {
+    freenode(cond);
+    return NULL;
+  }
+
+  return mknode(type, cond, body);
+}
+
+static node_t *parse_for(parser_t *p) {
+  token_t name = peek(p);
+  if (!string_p(name) || varnamelen(name) != strlen(name))
+    return syntax_error(p);
+  p->pos++;
+
+  token_t *words = NULL;
+  int nwords = -1; /* iterate over positional parameters */
+
+  if (expect(p, "in")) {
+    words = p->token + p->pos;
+    for (nwords = 0; string_p(peek(p)); nwords++)
+      p->pos++;
+  }
+
+  /* Separator is optional only if there's no word list. */
+  if (peek(p) == T_COLON)
+    p->pos++;
+  else if (nwords >= 0)
+    return syntax_error(p);
+
+  if (!expect(p, "do"))
+    return syntax_error(p);
+
+  node_t *body = parse_body(p, "done");
+  if (body == NULL)
+    return NULL;
+
+  node_t *n = mknode(N_FOR, NULL, body);
+  n->name = name;
+  n->token = words;
+  n->ntokens = nwords;
+  return n;
+}
+
+static node_t *parse_fundef(parser_t *p, size_t len) {
+  token_t name = p->token[p->pos++];
+  if (name[len] == '\0')
+    p->pos++; /* skip "()" */
+  name[len] = '\0';
+
+  int start = p->pos;
+  node_t *body = parse_compound(p);
+  if (body == NULL)
+    return (p->pos > start) ? NULL : syntax_error(p);
+
+  node_t *n = mknode(N_FUNC, body, NULL);
+  n->name = name;
+  return n;
+}
+
+/* Returns NULL without consuming anything if there's no compound command. */
+static node_t *parse_compound(parser_t *p) {
+  size_t len;
+
+  if (expect(p, "if"))
+    return parse_if(p);
+  if (expect(p, "while"))
+    return parse_while(p, N_WHILE);
+  if (expect(p, "until"))
+    return parse_while(p, N_UNTIL);
+  if (expect(p, "for"))
+    return parse_for(p);
+  if (expect(p, "{"))
+    return parse_body(p, "}");
+  if ((len = fundef_p(p)))
+    return parse_fundef(p, len);
+  return NULL;
+}
+
+static node_t *parse_pipeline(parser_t *p) {
+  bool negate = false;
+
+  if (peek(p) == T_BANG) {
+    negate = true;
+    p->pos++;
+  }
+
+  int start = p->pos;
+  node_t *n = parse_compound(p);
+
+  if (n) {
+    /* Compound commands cannot be redirected or put into a pipeline. */
+    if (!separator_p(peek(p)) || peek(p) == T_PIPE) {
+      freenode(n);
+      return syntax_error(p);
+    }
+    return negate ? mknode(N_NOT, n, NULL) : n;
+  }
+
+  if (p->pos > start)
+    return NULL; /* malformed compound command was reported already */
+
+  bool empty = true;
+
+  for (token_t tok; (tok = peek(p)) && !(separator_p(tok) && tok != T_PIPE);
+       p->pos++) {
+    if (tok == T_PIPE) {
+      if (empty)
+        return syntax_error(p);
+      empty = true;
+    } else if (tok == T_BANG) {
+      /* Exclamation mark is special only in front of a pipeline. */
+      p->token[p->pos] = "!";
+      empty = false;
+    } else if (string_p(tok)) {
+      empty = false;
+    }
+  }
+
+  if (empty)
+    return syntax_error(p);
+
+  n = mknode(N_CMD, NULL, NULL);
+  n->token = p->token + start;
+  n->ntokens = p->pos - start;
+  return negate ? mknode(N_NOT, n, NULL) : n;
+}
+
+static node_t *parse_andor(parser_t *p) {
+  node_t *n = parse_pipeline(p);
+
+  while (n && (peek(p) == T_AND || peek(p) == T_OR)) {
+    int type = (p->token[p->pos++] == T_AND) ? N_AND : N_OR;
+    node_t *right = parse_pipeline(p);
+    n = right ? mknode(type, n, right) : (freenode(n), NULL);
+  }
+
+  return n;
+}
+
+/* Parse list up to the end of tokens or a reserved word that terminates it.
+ * Returns NULL if list is empty or malformed. */
+static node_t *parse_list(parser_t *p) {
+  node_t *n = NULL;
+
+  while (p->pos < p->ntokens && !terminator_p(p)) {
+    node_t *item = parse_andor(p);
+    if (item == NULL) {
+      freenode(n);
+      return NULL;
+    }
+
+    if (peek(p) == T_BGJOB) {
+      /* Only a pipeline can be run in background without a subshell. */
+      node_t *job = (item->type == N_NOT) ? item->left : item;
+      if (job->type != N_CMD) {
+        if (job->type == N_AND || job->type == N_OR)
+          msg("background execution of && and || lists is not supported\n");
+        else
+          msg("background execution of compound commands is not supported\n");
+        freenode(item);
+        freenode(n);
+        return NULL;
+      }
+      job->bg = true;
+    }
+
+    if (separator_p(peek(p)) && peek(p) != T_NULL)
+      p->pos++; /* consume ';' or '&' */
+
+    n = n ? mknode(N_SEQ, n, item) : item;
+  }
+
+  return n ? n : syntax_error(p);
+}
+
+/* Returns syntax tree of command line or NULL if it's empty or malformed.
+ * Tokens are modified in place and must outlive the tree. */
+node_t *parse(token_t *token, int ntokens) {
+  parser_t p = {.token = token, .ntokens = ntokens, .pos = 0};
+
+  if (ntokens == 0)
+    return NULL;
+
+  node_t *n = parse_list(&p);
+  if (n && p.pos < p.ntokens) {
+    freenode(n);
+    return syntax_error(&p);
+  }
+  return n;
+}
@@ -0,0 +1,251 @@
+#include <sys/inotify.h>
+#include <dirent.h>
+
+#include "shell.h"
+
+/*
+ * Index of executables found in directories listed in PATH.
+ *
+ * Directories are read with getdents(2) into a large buffer and d_type is used
+ * to skip entries that cannot be executed without calling stat(2) for each of
+ * them. Index is built lazily when a command is looked up or completion is
+ * requested for the first time. Afterwards inotify watches mark directories
+ * that changed, so only those are read again, and only when the index is
+ * consulted.
+ */
+
+#define DENTS_BUFSIZE (256 * 1024)
+#define IN_EVENTS                                                              \
+  (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB |           \
+   IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+typedef struct {
+  char *path;  /* directory name taken from PATH */
+  int wd;      /* inotify watch descriptor or -1 */
+  bool dirty;  /* contents changed since last scan */
+  char *names; /* NUL-separated names of entries */
+  int nnames;  /* number of entries in names */
+} pathdir_t;
+
+typedef struct {
+  const char *name; /* points into names of respective directory */
+  int dir;          /* index of directory in PATH order */
+} pathent_t;
+
+static char *indexed_path = NULL; /* value of PATH the index was built for */
+static pathdir_t *dirs = NULL;
+static int ndirs = 0;
+static pathent_t *entries = NULL; /* sorted by name, then by directory */
+static int nentries = 0;
+static int inotify_fd = -1;
+
+static void readpathdir(pathdir_t *dir) {
+  static char *buf = NULL;
+  size_t size = 0, used = 0;
+
+  free(dir->names);
+  dir->names = NULL;
+  dir->nnames = 0;
+  dir->dirty = false;
+
+  int fd = open(dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0)
+    return;
+
+  if (buf == NULL)
+    buf = Malloc(DENTS_BUFSIZE);
+
+  int n;
+  while ((n = Getdents(fd, (struct linux_dirent *)buf, DENTS_BUFSIZE)) > 0) {
+    for (int off = 0; off < n;) {
+      struct linux_dirent *d = (struct linux_dirent *)(buf + off);
+      char type = buf[off + d->d_reclen - 1];
+      off += d->d_reclen;
+
+      if (type != DT_REG && type != DT_LNK && type != DT_UNKNOWN)
+        continue;
+      if (d->d_name[0] == '.')
+        continue;
+
+      size_t len = strlen(d->d_name) + 1;
+      if (used + len > size) {
+        size = max(size * 2, used + len + 4096);
+        dir->names = Realloc(dir->names, size);
+      }
+      memcpy(dir->names + used, d->d_name, len);
+      used += len;
+      dir->nnames++;
+    }
+  }
+
+  Close(fd);
+}
+
+static int entcmp(const void *a, const void *b) {
+  const pathent_t *x = a, *y = b;
+  int rc = strcmp(x->name, y->name);
+  return rc ? rc : x->dir - y->dir;
+}
+
+static void sortentries(void) {
+  nentries = 0;
+  for (int i = 0; i < ndirs; i++)
+    nentries += dirs[i].nnames;
+
+  entries = Realloc(entries, sizeof(pathent_t) * (nentries + 1));
+
+  pathent_t *e = entries;
+  for (int i = 0; i < ndirs; i++) {
+    const char *name = dirs[i].names;
+    for (int j = 0; j < dirs[i].nnames; j++) {
+      *e++ = (pathent_t){.name = name, .dir = i};
+      name += strlen(name) + 1;
+    }
+  }
+
+  qsort(entries, nentries, sizeof(pathent_t), entcmp);
+}
+
+static void dropindex(void) {
+  for (int i = 0; i < ndirs; i++) {
+    free(dirs[i].path);
+    free(dirs[i].names);
+  }
+  free(dirs);
+  free(indexed_path);
+  dirs = NULL;
+  ndirs = 0;
+  indexed_path = NULL;
+  nentries = 0;
+
+  /* Closing inotify descriptor removes all watches. */
+  if (inotify_fd >= 0)
+    Close(inotify_fd);
+  inotify_fd = -1;
+}
+
+static void buildindex(const char *path) {
+  indexed_path = strdup(path);
+
+  inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+  for (const char *s = path;;) {
+    size_t len = strcspn(s, ":");
+    dirs = Realloc(dirs, sizeof(pathdir_t) * (ndirs + 1));
+    pathdir_t *dir = &dirs[ndirs++];
+    /* Empty entry in PATH stands for current working directory. */
+    dir->path = len ? strndup(s, len) : strdup(".");
+    dir->names = NULL;
+    dir->wd = -1;
+    if (inotify_fd >= 0)
+      dir->wd = inotify_add_watch(inotify_fd, dir->path, IN_EVENTS);
+    readpathdir(dir);
+    if (s[len] == '\0')
+      break;
+    s += len + 1;
+  }
+
+  sortentries();
+}
+
+/* Mark directories reported by inotify as dirty.
+ * Returns true if any directory changed. */
+static bool readevents(void) {
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  bool changed = false;
+  ssize_t n;
+
+  while ((n = read(inotify_fd, buf, sizeof(buf))) > 0) {
+    for (char *p = buf; p < buf + n;) {
+      struct inotify_event *ev = (struct inotify_event *)p;
+      p += sizeof(struct inotify_event) + ev->len;
+      for (int i = 0; i < ndirs; i++) {
+        if (dirs[i].wd == ev->wd || (ev->mask & IN_Q_OVERFLOW)) {
+          dirs[i].dirty = true;
+          changed = true;
+        }
+      }
+    }
+  }
+
+  return changed;
+}
+
+/* Make sure the index reflects current PATH and contents of its directories.
+ * If `create` is false the index is only updated if it was built before. */
+void path_index(bool create) {
+  const char *path = getenv("PATH");
+
+  if (indexed_path && (!path || strcmp(path, indexed_path)))
+    dropindex();
+
+  if (!path)
+    return;
+
+  if (!indexed_path) {
+    if (create)
+      buildindex(path);
+    return;
+  }
+
+  if (inotify_fd < 0 || !readevents())
+    return;
+
+  for (int i = 0; i < ndirs; i++)
+    if (dirs[i].dirty)
+      readpathdir(&dirs[i]);
+
+  sortentries();
+}
+
+/* Returns index of the first entry not less than `name`. */
+static int lowerbound(const char *name) {
+  int lo = 0, hi = nentries;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (strcmp(entries[mid].name, name) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/* Returns absolute path of an executable found in PATH or NULL if the index
+ * was not built or the name is unknown. The result is a static buffer. */
+const char *path_lookup(const char *name) {
+  static char file[PATH_MAX];
+  const char *path = getenv("PATH");
+
+  if (!indexed_path || !path || strcmp(path, indexed_path))
+    return NULL;
+
+  int i = lowerbound(name);
+  if (i == nentries || strcmp(entries[i].name, name))
+    return NULL;
+
+  snprintf(file, sizeof(file), "%s/%s", dirs[entries[i].dir].path, name);
+  return file;
+}
+
+/* Yields consecutive commands from PATH that start with `prefix`.
+ * Negative `*cursorp` starts the enumeration. */
+const char *path_complete(const char *prefix, int *cursorp) {
+  size_t len = strlen(prefix);
+  int i;
+
+  if (*cursorp < 0) {
+    i = lowerbound(prefix);
+  } else {
+    /* Skip the same command found in directories later in PATH. */
+    for (i = *cursorp + 1;
+         i < nentries && !strcmp(entries[i].name, entries[*cursorp].name); i++)
+      continue;
+  }
+
+  if (i == nentries || strncmp(entries[i].name, prefix, len))
+    return NULL;
+
+  *cursorp = i;
+  return entries[i].name;
+}
@@ -0,0 +1,121 @@
+#ifndef _RING_H_
+#define _RING_H_
+
+/*
+ * Ring of fixed size records in a shared mapping of a file.
+ *
+ * Any number of processes may write to the ring at the same time without
+ * system calls or locks. A writer claims a slot by bumping the head counter
+ * atomically, so records never overlap, and stores the sequence number of
+ * the record last to mark it complete. A reader copies the record and checks
+ * the sequence number again afterwards to tell whether the slot was reused
+ * meanwhile. Writers never wait for readers, so records overwritten before
+ * they were read are lost, and the reader reports them as such.
+ *
+ * Used by job log of the shell (see joblog.c and jlog.c) and by trace ring
+ * of trace.so (see trace.c and tracedump.c).
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Beginning of file header. Records follow the whole header, and each of
+ * them starts with 64-bit sequence number, which is 0 while it's written. */
+typedef struct {
+  uint32_t magic;
+  uint32_t recsize; /* size of a record */
+  uint32_t nrecs;   /* capacity of the ring */
+  uint32_t pad;
+  uint64_t head; /* number of records ever claimed */
+} ring_hdr_t;
+
+static inline uint64_t *ring_slot(const ring_hdr_t *hdr, const void *recs,
+                                  uint64_t seq) {
+  return (uint64_t *)((char *)recs + (seq - 1) % hdr->nrecs * hdr->recsize);
+}
+
+/* Check that the file of `size` bytes holds a ring of expected layout. */
+static inline bool ring_valid(const ring_hdr_t *hdr, uint32_t magic,
+                              uint32_t recsize, size_t hdrsize, size_t size) {
+  return size >= hdrsize && hdr->magic == magic && hdr->recsize == recsize &&
+         hdrsize + (size_t)hdr->nrecs * recsize <= size;
+}
+
+/* Claim a slot and publish the record, ignoring its sequence number. Safe
+ * to call from signal handlers. */
+static inline void ring_put(ring_hdr_t *hdr, void *recs, const void *rec) {
+  uint64_t seq = __atomic_add_fetch(&hdr->head, 1, __ATOMIC_RELAXED);
+  uint64_t *slot = ring_slot(hdr, recs, seq);
+
+  __atomic_store_n(slot, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(slot + 1, (const uint64_t *)rec + 1, hdr->recsize - sizeof(*slot));
+  __atomic_store_n(slot, seq, __ATOMIC_RELEASE);
+}
+
+/* Copy record with given sequence number. Returns false if it's not there,
+ * i.e. it's still being written or has been overwritten. */
+static inline bool ring_fetch(const ring_hdr_t *hdr, const void *recs,
+                              uint64_t seq, void *rec) {
+  uint64_t *slot = ring_slot(hdr, recs, seq);
+
+  if (__atomic_load_n(slot, __ATOMIC_ACQUIRE) != seq)
+    return false;
+  memcpy(rec, slot, hdr->recsize);
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(slot, __ATOMIC_RELAXED) == seq;
+}
+
+#define RING_STALL 10 /* polls a slot may stay unfilled before giving up */
+
+typedef struct {
+  const ring_hdr_t *hdr;
+  const void *recs;
+  uint64_t next;    /* sequence number of the next record to print */
+  uint64_t pending; /* record found unfilled by the last poll */
+  int npolls;       /* number of polls it has stayed unfilled */
+} ring_reader_t;
+
+/* Print records up to current head with `print`. When following the ring,
+ * stop at a record that is still being written and carry on from there next
+ * time, but not forever, since its writer might have died in the middle. */
+static inline void ring_dump(ring_reader_t *rd, bool follow,
+                             void (*print)(const void *rec)) {
+  const ring_hdr_t *hdr = rd->hdr;
+  uint64_t head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+  uint64_t seq = rd->next;
+
+  if (head - seq + 1 > hdr->nrecs) {
+    uint64_t first = head - hdr->nrecs + 1;
+    printf("# lost %lu records\n", (unsigned long)(first - seq));
+    seq = first;
+  }
+
+  for (; seq <= head; seq++) {
+    uint64_t rec[(hdr->recsize + 7) / 8];
+    if (ring_fetch(hdr, rd->recs, seq, rec)) {
+      print(rec);
+      continue;
+    }
+    if (head - seq + 1 > hdr->nrecs) {
+      printf("# lost record %lu\n", (unsigned long)seq);
+      continue;
+    }
+    if (follow) {
+      if (seq != rd->pending) {
+        rd->pending = seq;
+        rd->npolls = 0;
+      }
+      if (++rd->npolls <= RING_STALL)
+        break;
+    }
+    printf("# incomplete record %lu\n", (unsigned long)seq);
+  }
+
+  fflush(stdout);
+  rd->next = seq;
+}
+
+#endif /* !_RING_H_ */
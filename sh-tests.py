@@ -8,9 +8,12 @@ import pexpect
 import unittest
 import subprocess
 import random
+import socket
+import json
 import time
 import sys
-from tempfile import NamedTemporaryFile
+import urllib.request
+from tempfile import NamedTemporaryFile, TemporaryDirectory
 
 
 LOGFILE = 'sh-tests.{}.log'.format(os.getpid())
@@ -32,6 +35,14 @@ class ShellTesterSimple():
         self.sendline('exit\n')
         self.child.logfile.close()
 
+    def respawn(self, args=[], env=None):
+        """ Replaces the shell with one started with given arguments. """
+        self.sendline('quit')
+        logfile = self.child.logfile
+        self.child = pexpect.spawn('./shell', args, env=env)
+        self.child.logfile = logfile
+        self.child.setecho(False)
+
     def lines_before(self):
         before = self.child.before.decode('utf-8').split('\r\n')
         return [line.strip() for line in before if len(line)]
@@ -231,6 +242,8 @@ class TestShellSimple(ShellTesterSimple, unittest.TestCase):
 
         # check shell 'ls -l /proc/$pid/fd'
         lines = self.execute('ls -l /proc/%d/fd' % self.pid)
+        # PATH index keeps an inotify descriptor, which is close-on-exec.
+        lines = [line for line in lines if 'inotify' not in line]
         self.assertEqual(len(lines), 5)
         for i in range(4):
             self.assertIn('%d -> /dev/pts/' % i, lines[i + 1])
@@ -304,6 +317,342 @@ class TestShellSimple(ShellTesterSimple, unittest.TestCase):
         self.expect_exact("[1] killed 'sleep 1000' by signal 15")
         self.expect_exact("[2] killed 'sleep 2000' by signal 15")
 
+    def test_andor(self):
+        lines = self.execute('true && echo yes || echo no')
+        self.assertEqual(lines, ['yes'])
+        lines = self.execute('false && echo yes || echo no')
+        self.assertEqual(lines, ['no'])
+        lines = self.execute('! true || echo negated')
+        self.assertEqual(lines, ['negated'])
+        lines = self.execute('echo a; false; echo b')
+        self.assertEqual(lines, ['a', 'b'])
+        lines = self.execute('grep -q LIST include/queue.h | true && echo ok')
+        self.assertEqual(lines, ['ok'])
+
+    def test_builtins(self):
+        lines = self.execute('printf %s=%03d\\n a 1 b 22')
+        self.assertEqual(lines, ['a=001', 'b=022'])
+        lines = self.execute('[ 2 -gt 1 ] && test -f shell.c && echo ok')
+        self.assertEqual(lines, ['ok'])
+        lines = self.execute('test -d shell.c || false || echo failed')
+        self.assertEqual(lines, ['failed'])
+        lines = self.execute('no-such-cmd; echo $?; ls -d /; ls -d /')
+        self.assertEqual(lines, ['no-such-cmd: No such file or directory',
+                                 '127', '/', '/'])
+        with NamedTemporaryFile(mode='r') as outf:
+            self.execute('echo -n foo bar > ' + outf.name)
+            self.assertEqual(outf.read(), 'foo bar')
+
+    def test_variables(self):
+        lines = self.execute('X=a; Y=$X; echo $X${Y}c $ $Y')
+        self.assertEqual(lines, ['aac $ a'])
+        lines = self.execute('Z=3 env | grep ^Z=; echo z$Z')
+        self.assertEqual(lines, ['Z=3', 'z'])
+        lines = self.execute('export W=7; env | grep ^W=; unset W; echo w$W')
+        self.assertEqual(lines, ['W=7', 'w'])
+        lines = self.execute('false; echo $?; true; echo $?')
+        self.assertEqual(lines, ['1', '0'])
+        # Assignment in a pipeline runs in a subshell of its own.
+        lines = self.execute('V=1 | cat; echo $? v$V')
+        self.assertEqual(lines, ['0 v'])
+
+    def test_control(self):
+        lines = self.execute('for i in a {1..3}; do echo $i; done')
+        self.assertEqual(lines, ['a', '1', '2', '3'])
+        lines = self.execute(
+            'if false; then echo a; elif ! true; then echo b; else echo c; fi')
+        self.assertEqual(lines, ['c'])
+        lines = self.execute('i=x; while [ $i != xxx ]; do i=x$i; done; '
+                             'until true; do :; done; echo $i $?')
+        self.assertEqual(lines, ['xxx 0'])
+        lines = self.execute('for i in 1 2; do for j in a b c; do '
+                             '[ $j = b ] && continue 2; echo $i$j; done; '
+                             '[ $i = 2 ] && break; done')
+        self.assertEqual(lines, ['1a', '2a'])
+        lines = self.execute('for i in 1; do break 0; echo $?; '
+                             'continue foo; echo $?; done')
+        self.assertEqual(lines, ['break: 0: loop count out of range', '1',
+                                 'continue: foo: numeric argument required',
+                                 '1'])
+
+    def test_functions(self):
+        self.sendline('f() { echo $# $2; for x; do echo $x; done; return 3; }')
+        self.expect_exact('#')
+        lines = self.execute('f a b | tr a-z A-Z; f; echo $?')
+        self.assertEqual(lines, ['2 B', 'A', 'B', '0', '3'])
+        lines = self.execute('g() { g; }; g')
+        self.assertEqual(lines, ['g: maximum function nesting level exceeded'])
+        # Function runs in background too.
+        lines = self.execute('f x &')
+        for _ in range(100):
+            lines += self.execute('jobs')
+            if any('exited' in line for line in lines):
+                break
+        self.assertIn('x', lines)
+        self.assertIn("[1] exited 'f x', status=3", lines)
+
+    def test_arith(self):
+        lines = self.execute('i=5; echo $(( (i+3) * 2 )) $((i++)) $((i += 1 << 2)) '
+                             '$((i > 9 ? -7 / 2 : 0)) $((2**62*2))')
+        self.assertEqual(lines, ['16 5 10 -3 -9223372036854775808'])
+        lines = self.execute('n=0; for i in {1..100}; do n=$((n+i)); done; '
+                             'echo $n $(($n*2))')
+        self.assertEqual(lines, ['5050 10100'])
+        lines = self.execute('echo $((1/0))')
+        self.assertEqual(lines, ['1/0: division by zero'])
+
+    def test_cmdsubst(self):
+        lines = self.execute('x=$(echo a  b; true && echo c); echo [$x] '
+                             '$(printf %s- $(echo 1 2))')
+        self.assertEqual(lines, ['[a b c] 1-2-'])
+        lines = self.execute('n=$(seq 1 100000 | wc -l); echo $n $(( n+1 ))')
+        self.assertEqual(lines, ['100000 100001'])
+        lines = self.execute('x=$(false); echo $?')
+        self.assertEqual(lines, ['1'])
+
+    def test_coproc(self):
+        self.sendline('coproc ED sed -u s/^/got:/')
+        self.expect_exact("running 'sed -u s/^/got:/'")
+        self.expect('#')
+        lines = self.execute('echo hello >&${ED[1]}; head -n1 <&${ED[0]}')
+        self.assertEqual(lines, ['got:hello'])
+        lines = self.execute('echo x >&99; echo $?')
+        self.assertEqual(lines, ['99: bad file descriptor', '1'])
+
+    def test_braces(self):
+        lines = self.execute('echo a{b,c{1..3..2},}d {08..10} {c..a}')
+        self.assertEqual(lines, ['abd ac1d ac3d ad 08 09 10 c b a'])
+        lines = self.execute('echo {1..50000} | wc -w')
+        self.assertEqual(lines, ['50000'])
+        lines = self.execute('echo {1..100000000}')
+        self.assertEqual(lines, ['{1..100000000}: argument list too long'])
+        # Braces within substitutions and quotes are not expanded outside.
+        lines = self.execute(
+            "echo $(printf %s- {a,b}) x{$(echo 1,2),3} '{c,d}'")
+        self.assertEqual(lines, ["a-b- x1,2 x3 '{c,d}'"])
+
+    def test_glob(self):
+        with TemporaryDirectory() as top:
+            for name in ['x.gz', '.h.gz', 'a/y.gz', 'a/b/z.gz', 'd/w.txt']:
+                path = os.path.join(top, name)
+                os.makedirs(os.path.dirname(path), exist_ok=True)
+                open(path, 'w').close()
+            lines = self.execute('cd {}; echo **/*.gz; echo [a-c]*/ ?.* no*'
+                                 .format(top))
+            self.assertEqual(lines, ['a/b/z.gz a/y.gz x.gz', 'a/ x.gz no*'])
+
+    def test_history(self):
+        token = 'h%d' % random.randrange(10**6, 10**7)
+        self.execute('true ' + token)
+        self.execute('true other')
+        # The most recent match is 'history ...' command itself.
+        lines = self.execute('history ' + token)
+        self.assertTrue(lines[-1].endswith('true ' + token))
+        self.assertFalse(any('other' in line for line in lines))
+        # Index of a truncated file is thrown away.
+        open(os.environ['HISTFILE'], 'w').close()
+        lines = self.execute('history ' + token)
+        self.assertFalse(any(line.endswith('true ' + token)
+                             for line in lines))
+        self.assertEqual(self.execute('echo alive'), ['alive'])
+
+    def test_history_search(self):
+        token = 'r%d' % random.randrange(10**6, 10**7)
+        self.execute('echo found ' + token)
+        self.execute('echo other')
+        # Ctrl-R replaces the line with the most recent match.
+        self.send(token[:4])
+        self.sendcontrol('r')
+        self.sendline('')
+        self.expect('found ' + token + r'\r\n')
+        self.expect('#')
+
+    def test_launcher(self):
+        self.respawn(['--launcher'])
+        self.expect('#')
+        lines = self.execute('grep PPid /proc/self/status | cat')
+        self.assertEqual(lines, ['PPid:\t%d' % self.pid])
+        lines = self.execute('cd /; X=1 env | grep ^X=; pwd')
+        self.assertEqual(lines, ['X=1', '/'])
+        lines = self.execute('no-such-cmd; echo $?')
+        self.assertEqual(lines[-1], '127')
+
+    def test_events(self):
+        with TemporaryDirectory() as top:
+            path = os.path.join(top, 'events.sock')
+            agent = socket.socket(socket.AF_UNIX)
+            agent.bind(path)
+            agent.listen(1)
+            self.respawn(['--events', path])
+            conn, _ = agent.accept()
+            self.expect('#')
+            self.execute('true | false')
+            # Jobs of subshells are not reported.
+            self.assertEqual(self.execute('echo $(true | true; echo x)'),
+                             ['x'])
+            self.sendline('quit')
+            self.child.expect(pexpect.EOF)
+            with conn.makefile() as f:
+                events = [json.loads(line) for line in f]
+            agent.close()
+        names = [e['event'] for e in events]
+        self.assertEqual(names[0], 'add')
+        self.assertEqual(names[-1], 'delete')
+        # Processes of a pipeline may finish in any order.
+        self.assertEqual(sorted(names[1:-1]),
+                         ['exit', 'exit', 'spawn', 'spawn'])
+        exits = [e for e in events if e['event'] == 'exit']
+        self.assertEqual(sorted(e['status'] for e in exits), [0, 1])
+        self.assertEqual(events[-1]['status'], 1)
+        self.assertEqual(exits[0]['pgid'], events[0]['pid'])
+
+    def test_joblog(self):
+        with TemporaryDirectory() as top:
+            path = os.path.join(top, 'jobs.log')
+            self.respawn(['--joblog', path])
+            self.expect('#')
+            self.execute('true | false')
+            self.execute('sleep 1000 &')
+            self.execute('kill %1')
+            self.execute('echo $(true | cat)')
+            shell = str(self.child.pid)
+            self.sendline('quit')
+            self.child.expect(pexpect.EOF)
+            records = subprocess.check_output(['./jlog', path]).decode()
+            # Writer that claimed a slot and died must not stall the reader.
+            with open(path, 'r+b') as f:
+                f.seek(16)
+                head = int.from_bytes(f.read(8), 'little')
+                f.seek(16)
+                f.write((head + 1).to_bytes(8, 'little'))
+            jlog = pexpect.spawn('./jlog', ['-f', path], timeout=5)
+            jlog.expect('# incomplete record {}'.format(head + 1))
+            jlog.terminate(force=True)
+        records = [line.split() for line in records.splitlines()]
+        self.assertEqual([r[0] for r in records],
+                         [str(i + 1) for i in range(len(records))])
+        events = [r[3] for r in records if r[2] == shell]
+        self.assertEqual(events.count('spawn'), 3)
+        self.assertEqual(events.count('exit'), 3)
+        self.assertIn('kill', events)
+        self.assertIn(['true', '|', 'false'], [r[9:] for r in records])
+        # Jobs of a subshell are logged under its own pid.
+        shells = {' '.join(r[9:]): r[2] for r in records if r[3] == 'delete'}
+        self.assertEqual(shells['true | false'], shell)
+        self.assertNotEqual(shells['true | cat'], shell)
+
+    def test_metrics(self):
+        with socket.socket() as s:
+            s.bind(('127.0.0.1', 0))
+            port = s.getsockname()[1]
+        self.respawn(['--metrics', str(port)])
+        self.expect('#')
+        self.execute('true | false')
+        self.execute('/nonexistent')
+        self.execute('sleep 1000 &')
+        url = 'http://127.0.0.1:{}/metrics'.format(port)
+        # Background job may not have reached execve yet.
+        for _ in range(100):
+            with urllib.request.urlopen(url) as r:
+                text = r.read().decode()
+            metrics = dict(line.rsplit(' ', 1) for line in text.splitlines()
+                           if not line.startswith('#'))
+            if metrics['shell_execs_total'] == '2':
+                break
+            time.sleep(0.01)
+        # Endpoint is reachable from this host only.
+        with open('/proc/net/tcp') as f:
+            listening = [line.split()[1] for line in f
+                         if line.split()[3] == '0A']
+        self.assertIn('0100007F:{:04X}'.format(port), listening)
+        self.assertEqual(metrics['shell_forks_total'], '4')
+        # Builtins in a pipeline run in forked children without execve.
+        self.assertEqual(metrics['shell_execs_total'], '2')
+        self.assertEqual(metrics['shell_exec_failures_total'], '1')
+        self.assertEqual(metrics['shell_jobs{state="running"}'], '1')
+        self.assertEqual(metrics['shell_fork_exec_seconds_count'], '2')
+        self.assertEqual(metrics['shell_monitorjob_wait_seconds_count'], '2')
+        self.assertEqual(
+            metrics['shell_monitorjob_wait_seconds_bucket{le="+Inf"}'], '2')
+
+    def test_path_index(self):
+        with socket.socket() as s:
+            s.bind(('127.0.0.1', 0))
+            port = s.getsockname()[1]
+        self.respawn(['--metrics', '127.0.0.1:{}'.format(port)])
+        self.expect('#')
+        self.assertEqual(self.execute('cat /dev/null'), [])
+        self.assertEqual(self.execute('cat /dev/null | cat'), [])
+        url = 'http://127.0.0.1:{}/metrics'.format(port)
+        with urllib.request.urlopen(url) as r:
+            text = r.read().decode()
+        metrics = dict(line.rsplit(' ', 1) for line in text.splitlines()
+                       if not line.startswith('#'))
+        # Commands are found in PATH index without probing directories.
+        self.assertEqual(metrics['shell_execs_total'], '3')
+        self.assertEqual(metrics['shell_path_probes_total'], '0')
+
+    def test_resolve_once(self):
+        with socket.socket() as s:
+            s.bind(('127.0.0.1', 0))
+            port = s.getsockname()[1]
+        with TemporaryDirectory() as top:
+            # Hidden files are left out of PATH index, so PATH is searched.
+            os.symlink('/bin/true', os.path.join(top, '.hidden'))
+            env = dict(os.environ, PATH=top + ':' + os.environ['PATH'])
+            self.respawn(['--metrics', str(port)], env=env)
+            self.expect('#')
+            for i in range(3):
+                self.execute('.hidden')
+            url = 'http://127.0.0.1:{}/metrics'.format(port)
+            with urllib.request.urlopen(url) as r:
+                text = r.read().decode()
+        metrics = dict(line.rsplit(' ', 1) for line in text.splitlines()
+                       if not line.startswith('#'))
+        # Location found for the first line is reused by the following ones.
+        self.assertEqual(metrics['shell_execs_total'], '3')
+        self.assertEqual(metrics['shell_path_probes_total'], '1')
+
+    def test_daemon(self):
+        with TemporaryDirectory() as top:
+            sock = os.path.join(top, 'shell.sock')
+            daemon = subprocess.Popen(['./shell', '--daemon', sock],
+                                      stdin=subprocess.DEVNULL)
+            try:
+                while not os.path.exists(sock):
+                    time.sleep(0.01)
+                self.assertEqual(os.stat(sock).st_mode & 0o777, 0o600)
+                client = pexpect.spawn(os.path.abspath('shc'), [sock],
+                                       cwd=top)
+                client.setecho(False)
+                client.expect('#')
+                client.sendline('pwd; tty')
+                client.expect('#')
+                lines = client.before.decode('utf-8').split('\r\n')
+                self.assertIn(top, [line.strip() for line in lines])
+                self.assertNotIn('not a tty', lines)
+                client.sendline('cat')
+                client.sendline('hello')
+                client.expect('hello')
+                client.sendintr()
+                client.expect('#')
+                client.sendline('quit')
+                client.expect(pexpect.EOF)
+            finally:
+                daemon.terminate()
+                daemon.wait()
+
+            # Files other than stale sockets are never removed.
+            path = os.path.join(top, 'precious')
+            with open(path, 'w') as f:
+                f.write('precious')
+            daemon = subprocess.run(['./shell', '--daemon', path],
+                                    stdin=subprocess.DEVNULL,
+                                    stderr=subprocess.DEVNULL)
+            self.assertNotEqual(daemon.returncode, 0)
+            with open(path) as f:
+                self.assertEqual(f.read(), 'precious')
+
 
 class TestShellWithSyscalls(ShellTester, unittest.TestCase):
     def stty(self):
@@ -353,6 +702,118 @@ class TestShellWithSyscalls(ShellTester, unittest.TestCase):
         self.sendline('jobs')
         self.expect_exact("[1] killed 'cat' by signal 15")
 
+    def test_trace_ring(self):
+        with TemporaryDirectory() as top:
+            ring = os.path.join(top, 'trace.ring')
+            env = dict(os.environ, TRACE_RING=ring)
+            self.respawn(env=env)
+            self.expect('#')
+            self.sendline('cat /dev/null')
+            self.expect('#')
+            self.assertNotIn('fork()', self.child.before.decode('utf-8'))
+            self.sendline('quit')
+            self.child.expect(pexpect.EOF)
+            env = {k: v for k, v in os.environ.items() if k != 'LD_PRELOAD'}
+            lines = subprocess.check_output(['./tracedump', ring],
+                                            env=env).decode().splitlines()
+        forks = [line for line in lines if 'fork() = ' in line]
+        self.assertEqual(len(forks), 1)
+        child = forks[0].split(' = ')[1]
+        # Location of cat depends on PATH.
+        self.assertRegex('\n'.join(lines),
+                         r'\[{0}:{0}\] execve\("[^"]*cat",'.format(child))
+
+    def test_trace_stats(self):
+        env = dict(os.environ, TRACE_STATS='1', TRACE_TIME='1')
+        self.respawn(env=env)
+        self.expect('#')
+        self.sendline('cat /dev/null')
+        self.expect(r'\d+\.\d{9} \[\d+:\d+\] fork\(\) = \d+')
+        self.expect('#')
+        self.sendline('quit')
+        self.expect(r'fork -> execve: count=1 ')
+        self.expect(r'execve -> waitpid: count=1 ')
+        self.child.expect(pexpect.EOF)
+
+    def test_trace_count(self):
+        env = dict(os.environ, TRACE_MODE='count',
+                   TRACE_FILTER='fork,execve,waitpid')
+        self.respawn(env=env)
+        self.expect('#')
+        self.sendline('cat /dev/null')
+        self.expect(r'\[\d+\] execve: 1 calls, \d+us')
+        self.expect('#')
+        self.sendline('quit')
+        self.expect(r'\[\d+\] fork: 1 calls, \d+us')
+        self.expect(r'\[\d+\] waitpid: \d+ calls, \d+us')
+        self.child.expect(pexpect.EOF)
+        self.assertNotIn(b'close', self.child.before)
+
+    def test_trace_pipes(self):
+        self.sendline('echo $(ls /dev/null)')
+        # Patterns match across lines, so flags of pipe2 are spelled out
+        # rather than matched with ".*", which could swallow the fcntl line.
+        self.expect(r'pipe2?\(\[\d+, \d+\](, \d+)?\) = 0')
+        self.expect(r'fcntl\(\d+, F_SETPIPE_SZ, \d+\) = \d+')
+        self.expect('#')
+
+    def test_trace_wait(self):
+        with TemporaryDirectory() as top:
+            script = os.path.join(top, 'wait.py')
+            with open(script, 'w') as f:
+                f.write('import os\n'
+                        'pid = os.fork() or os._exit(3)\n'
+                        'os.wait4(pid, 0)\n'
+                        'pid = os.fork() or os._exit(4)\n'
+                        'os.waitid(os.P_PID, pid, os.WEXITED)\n')
+            self.sendline('python3 ' + script)
+            self.expect(r'wait4\(\.\.\.\) -> \{pid=\d+, status=3\}')
+            self.expect(r'waitid\(\.\.\.\) -> \{pid=\d+, status=4\}')
+            self.expect('#')
+
+    def test_trace_io(self):
+        with TemporaryDirectory() as top:
+            script = os.path.join(top, 'io.sh')
+            with open(script, 'w') as f:
+                f.write('echo hello\nexec true\n')
+            env = dict(os.environ, TRACE_IO='1', TRACE_FILTER='dup,execve')
+            self.respawn(env=env)
+            # Shell keeps a copy of terminal descriptor for job control.
+            self.expect(r'dup\(0\) = \d+')
+            self.expect('#')
+            # Counts are printed before execve replaces the process.
+            self.sendline('/bin/sh ' + script)
+            self.expect(r'\[(\d+):\d+\] execve\("[^"]*true"[^\r]*\r\n'
+                        r'\[\1\] fd 1: read 0 bytes in 0 calls, '
+                        r'wrote 6 bytes in 1 calls')
+            self.expect('#')
+            self.sendline('quit')
+            self.child.expect(pexpect.EOF)
+
+    def test_trace2chrome(self):
+        with TemporaryDirectory() as top:
+            ring = os.path.join(top, 'trace.ring')
+            env = dict(os.environ, TRACE_RING=ring)
+            self.respawn(env=env)
+            self.expect('#')
+            self.sendline('cat /dev/null | cat')
+            self.expect('#')
+            self.sendline('quit')
+            self.child.expect(pexpect.EOF)
+            env = {k: v for k, v in os.environ.items() if k != 'LD_PRELOAD'}
+            dump = subprocess.run(['./tracedump', '-t', ring], env=env,
+                                  stdout=subprocess.PIPE, check=True)
+            conv = subprocess.run(['./trace2chrome.py'], input=dump.stdout,
+                                  env=env, stdout=subprocess.PIPE, check=True)
+        events = json.loads(conv.stdout)['traceEvents']
+        spans = [e for e in events if e['ph'] == 'X']
+        self.assertEqual([e['name'] for e in spans], ['cat', 'cat'])
+        self.assertTrue(all(e['dur'] > 0 for e in spans))
+        self.assertEqual(spans[0]['args']['status'], '0')
+        execs = [e['pid'] for e in events if e['name'] == 'execve']
+        self.assertEqual(sorted(execs), sorted(e['pid'] for e in spans))
+        self.assertIn('foreground', [e['name'] for e in events])
+
     def test_termattr_1(self):
         stty_before = self.stty()
         self.sendline('more shell.c')
@@ -382,6 +843,7 @@ class TestShellWithSyscalls(ShellTester, unittest.TestCase):
 if __name__ == '__main__':
     os.environ['PATH'] = '/usr/bin:/bin'
     os.environ['LC_ALL'] = 'C'
+    os.environ['HISTFILE'] = 'sh-tests.{}.history'.format(os.getpid())
 
     ldd = subprocess.run(['ldd', 'shell'], stdout=subprocess.PIPE)
     for line in ldd.stdout.decode('utf-8').splitlines():
@@ -406,4 +868,6 @@ if __name__ == '__main__':
     try:
         unittest.main()
     finally:
+        if os.path.exists(os.environ['HISTFILE']):
+            os.unlink(os.environ['HISTFILE'])
         print(f'\nTest results were saved to "{LOGFILE}".')
@@ -0,0 +1,281 @@
+#include <pty.h>
+#include <sys/ioctl.h>
+
+#include "shell.h"
+
+/*
+ * Micro-benchmarks of shell's hot paths.
+ *
+ * Each benchmark reports time and number of heap allocations per operation.
+ * Allocations are counted by wrappers of allocator functions, which the
+ * linker puts in place of the real ones with "--wrap". Calls to execve are
+ * wrapped as well, so that external_command resolves a command and jumps
+ * back instead of replacing the process. Those benchmarks run in a forked
+ * child, since jumping out of external_command leaks what it allocated.
+ *
+ * Job control code needs a controlling terminal, so the benchmarks run in
+ * a session of their own with a pseudo-terminal on standard input.
+ */
+
+/* Definitions normally provided by shell.c. */
+sigset_t sigchld_mask;
+volatile sig_atomic_t interrupted;
+
+int coproc(const char *name, char **argv) {
+  return -1;
+}
+
+static long nallocs = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+char *__real_strdup(const char *s);
+char *__real_strndup(const char *s, size_t n);
+
+void *__wrap_malloc(size_t size) {
+  nallocs++;
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+  nallocs++;
+  return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  nallocs++;
+  return __real_realloc(ptr, size);
+}
+
+char *__wrap_strdup(const char *s) {
+  nallocs++;
+  return __real_strdup(s);
+}
+
+char *__wrap_strndup(const char *s, size_t n) {
+  nallocs++;
+  return __real_strndup(s, n);
+}
+
+static jmp_buf exec_env;
+static long nexecs = 0;
+
+/* Fail as execve would for files that cannot be executed. */
+int __wrap_execve(const char *path, char *const argv[], char *const envp[]) {
+  if (access(path, X_OK) < 0)
+    return -1;
+  nexecs++;
+  longjmp(exec_env, 1);
+}
+
+typedef void (*op_t)(void *arg);
+
+static double scale = 1.0; /* multiplier of number of iterations */
+static int devnull;
+
+static void report(const char *name, long n, long ns, long allocs) {
+  printf("%-30s %10ld %10.1f %10.2f\n", name, n, (double)ns / n,
+         (double)allocs / n);
+}
+
+static void bench(const char *name, op_t op, void *arg, long n) {
+  n = max(n * scale, 1.0);
+  long allocs = nallocs;
+  long start = nanotime();
+  for (long i = 0; i < n; i++)
+    op(arg);
+  report(name, n, nanotime() - start, nallocs - allocs);
+}
+
+/* Run benchmark in a child process, which is thrown away afterwards. */
+static void bench_child(const char *name, op_t op, void *arg, long n) {
+  fflush(stdout);
+  pid_t pid = Fork();
+  if (pid == 0) {
+    bench(name, op, arg, n);
+    fflush(stdout);
+    _exit(nexecs > 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+  }
+  int status;
+  Waitpid(pid, &status, 0);
+  if (!WIFEXITED(status) || WEXITSTATUS(status))
+    app_error("%s: benchmark failed", name);
+}
+
+static const char *corpus[] = {
+  "ls -l",
+  "cat shell.c | grep -v foo | wc -l",
+  "make -j4 > build.log 2>&1 &",
+  "cd /tmp && ls || echo failed ; pwd",
+  "sort < input.txt >> output.txt",
+  "echo $(ls /dev/null) $((1 + 2)) ${HOME}",
+  "for i in a b c ; do echo $i ; done",
+  "! grep -q pattern file.txt",
+  NULL,
+};
+
+static void op_tokenize(void *arg) {
+  static int next = 0;
+  char line[256];
+  int ntokens;
+
+  if (corpus[next] == NULL)
+    next = 0;
+  strcpy(line, corpus[next++]);
+  free(tokenize(line, &ntokens));
+}
+
+static void op_builtin(void *arg) {
+  (void)builtin_command(arg, devnull);
+}
+
+static void op_external(void *arg) {
+  if (!setjmp(exec_env))
+    external_command(arg);
+}
+
+/* Jobs are backed by children that have already exited, so that they can
+ * be reaped and reported as finished. */
+static void bench_jobs(int njobs) {
+  char *argv[] = {"sleep", "1000", NULL};
+  pid_t *pids = Malloc(sizeof(pid_t) * njobs);
+  sigset_t mask;
+  int fds[2];
+
+  Sigprocmask(SIG_BLOCK, &sigchld_mask, &mask);
+
+  /* Reading end gets EOF when all children are gone. */
+  Pipe(fds);
+  for (int i = 0; i < njobs; i++)
+    if ((pids[i] = Fork()) == 0)
+      _exit(EXIT_SUCCESS);
+  Close(fds[1]);
+  char c;
+  while (Read(fds[0], &c, 1) > 0)
+    continue;
+  Close(fds[0]);
+
+  long allocs = nallocs;
+  long start = nanotime();
+  for (int i = 0; i < njobs; i++) {
+    int j = addjob(pids[i], BG);
+    addproc(j, pids[i], argv);
+  }
+  report("addjob + addproc", njobs, nanotime() - start, nallocs - allocs);
+
+  /* Reports go to stderr, which is not interesting here. */
+  int stderr_fd = Dup(STDERR_FILENO);
+  Dup2(devnull, STDERR_FILENO);
+
+  allocs = nallocs;
+  start = nanotime();
+  watchjobs(RUNNING);
+  long ns = nanotime() - start;
+  Dup2(stderr_fd, STDERR_FILENO);
+  report("watchjobs (running)", njobs, ns, nallocs - allocs);
+
+  /* Pending SIGCHLD is delivered here and the handler reaps all of them. */
+  Sigprocmask(SIG_SETMASK, &mask, NULL);
+  Sigprocmask(SIG_BLOCK, &sigchld_mask, &mask);
+
+  Dup2(devnull, STDERR_FILENO);
+  allocs = nallocs;
+  start = nanotime();
+  watchjobs(FINISHED);
+  ns = nanotime() - start;
+  Dup2(stderr_fd, STDERR_FILENO);
+  Close(stderr_fd);
+  report("watchjobs (finished)", njobs, ns, nallocs - allocs);
+
+  Sigprocmask(SIG_SETMASK, &mask, NULL);
+  free(pids);
+}
+
+/* Move to a new session with a pseudo-terminal as controlling terminal and
+ * standard input. Parent waits for the benchmarks and passes on the result. */
+static void session(void) {
+  fflush(stdout);
+  pid_t pid = Fork();
+  if (pid > 0) {
+    int status;
+    Waitpid(pid, &status, 0);
+    exit(exitstatus(status));
+  }
+
+  int master, slave;
+  if (openpty(&master, &slave, NULL, NULL, NULL) < 0)
+    unix_error("openpty error");
+  Setsid();
+  if (ioctl(slave, TIOCSCTTY, 0) < 0)
+    unix_error("ioctl error");
+  Dup2(slave, STDIN_FILENO);
+  Close(slave);
+  fcntl(master, F_SETFD, FD_CLOEXEC);
+}
+
+int main(int argc, char *argv[]) {
+  int njobs = 256;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "j:s:")) != -1) {
+    if (opt == 'j')
+      njobs = atoi(optarg);
+    else if (opt == 's')
+      scale = atof(optarg);
+    else
+      app_error("usage: %s [-j jobs] [-s scale]", argv[0]);
+  }
+
+  session();
+
+  sigemptyset(&sigchld_mask);
+  sigaddset(&sigchld_mask, SIGCHLD);
+  initjobs();
+
+  /* Results must not depend on the environment. Hidden names are left out
+   * of PATH index, so one put in the last directory of PATH can only be
+   * found by trying directories one by one. */
+  char tmpdir[] = "/tmp/shbench.XXXXXX";
+  if (!mkdtemp(tmpdir))
+    unix_error("mkdtemp error");
+  char hidden[sizeof(tmpdir) + 8];
+  snprintf(hidden, sizeof(hidden), "%s/.cat", tmpdir);
+  if (symlink("/bin/cat", hidden) < 0)
+    unix_error("symlink error");
+  char path[256];
+  snprintf(path, sizeof(path),
+           "/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin:%s",
+           tmpdir);
+  setenv("PATH", path, 1);
+  devnull = Open("/dev/null", O_WRONLY | O_CLOEXEC, 0);
+
+  printf("%-30s %10s %10s %10s\n", "benchmark", "ops", "ns/op", "allocs/op");
+
+  bench("tokenize", op_tokenize, NULL, 1000000);
+
+  char *btrue[] = {"true", NULL};
+  char *becho[] = {"echo", "hello", "world", NULL};
+  char *bnone[] = {"nosuchbuiltin", NULL};
+  bench("builtin_command (true)", op_builtin, btrue, 1000000);
+  bench("builtin_command (echo)", op_builtin, becho, 200000);
+  bench("builtin_command (missing)", op_builtin, bnone, 1000000);
+
+  /* Command remembered by find_command is tried first, others are looked up
+   * in PATH index, and those missing from the index in PATH directories. */
+  char *cached[] = {"ls", "-l", NULL};
+  char *indexed[] = {"cat", "-n", NULL};
+  char *search[] = {".cat", "-n", NULL};
+  intern(cached[0]);
+  find_command(cached[0]);
+  bench_child("external_command (cached)", op_external, cached, 200000);
+  bench_child("external_command (path index)", op_external, indexed, 200000);
+  bench_child("external_command (PATH scan)", op_external, search, 50000);
+
+  bench_jobs(njobs);
+
+  unlink(hidden);
+  rmdir(tmpdir);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,46 @@
+#include <sys/ioctl.h>
+
+#include "csapp.h"
+
+/*
+ * Thin client of shell daemon started with "shell --daemon SOCKET".
+ *
+ * Passes terminal along with working directory to a session that has been
+ * initialized in advance by the daemon and waits until the session ends.
+ * The client must be a session leader, e.g. a process started by terminal
+ * emulator or tmux, since it has to give up its controlling terminal.
+ */
+
+int main(int argc, char *argv[]) {
+  char cwd[PATH_MAX];
+
+  if (argc != 2)
+    app_error("usage: %s SOCKET", argv[0]);
+
+  if (!isatty(STDIN_FILENO))
+    app_error("ERROR: Client can run only in interactive mode!");
+
+  if (getsid(0) != getpid())
+    app_error("ERROR: Client must be a session leader (try setsid -w %s)!",
+              argv[0]);
+
+  int fd = Open_unix_clientfd(argv[1]);
+  Getcwd(cwd, sizeof(cwd));
+
+  /* Detaching from controlling terminal sends SIGHUP to our process group. */
+  Signal(SIGHUP, SIG_IGN);
+  if (ioctl(STDIN_FILENO, TIOCNOTTY) < 0)
+    unix_error("TIOCNOTTY error");
+
+  int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  if (send_fds(fd, cwd, strlen(cwd), fds, 3) < 0)
+    unix_error("send_fds error");
+
+  /* Session closes its end of connection when it exits. */
+  char c;
+  ssize_t n;
+  while ((n = read(fd, &c, 1)) > 0 || (n < 0 && errno == EINTR))
+    continue;
+
+  return 0;
+}
@@ -6,11 +6,35 @@
 #define DEBUG 0
 #include "shell.h"
 
+#include <sys/ioctl.h>
+
+#if defined(LINUX) && !defined(F_SETPIPE_SZ)
+#define F_SETPIPE_SZ 1031 /* Linux specific, hidden without _GNU_SOURCE */
+#endif
+
 sigset_t sigchld_mask;
+volatile sig_atomic_t interrupted;
+
+/* Exit status of the last command substitution, which becomes status of
+ * a command that consists of assignments only, as in "x=$(false)". */
+static int substatus;
+
+/* Start external commands with launcher process, see launch.c. */
+static bool use_launcher = false;
+
+/* Publish job events to this socket, see events.c. */
+static char *events_path = NULL;
+
+/* Record job events in this file, see joblog.c. */
+static char *joblog_path = NULL;
+
+/* Serve metrics on this [ADDR:]PORT, see metrics.c. */
+static char *metrics_addr = NULL;
 
 static void sigint_handler(int sig) {
-  /* No-op handler, we just need break read() call with EINTR. */
+  /* We just need break read() call with EINTR and stop running loops. */
   (void)sig;
+  interrupted = true;
 }
 
 /* Rewrite closed file descriptors to -1,
@@ -22,10 +46,25 @@ static void MaybeClose(int *fdp) {
   *fdp = -1;
 }
 
+/* Duplicate descriptor given by number in redirection ">&N" or "<&N". */
+static int dupfd(const char *word) {
+  char *end;
+  long fd = strtol(word, &end, 10);
+  int newfd = -1;
+
+  if (*word && *end == '\0' && fd >= 0 && fd <= INT_MAX)
+    newfd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+  if (newfd < 0)
+    msg("%s: bad file descriptor\n", word);
+  return newfd;
+}
+
 /* Consume all tokens related to redirection operators.
- * Put opened file descriptors into inputp & output respectively. */
+ * Put opened file descriptors into inputp & output respectively.
+ * Returns -1 if a redirection failed. */
 static int do_redir(token_t *token, int ntokens, int *inputp, int *outputp) {
-  token_t mode = NULL; /* T_INPUT, T_OUTPUT or NULL */
+  token_t mode = NULL; /* T_INPUT, T_OUTPUT, T_DUPIN, T_DUPOUT or NULL */
+  bool failed = false;
   int n = 0;           /* number of tokens after redirections are removed */
 
   for (int i = 0; i < ntokens; i++) {
@@ -64,6 +103,13 @@ static int do_redir(token_t *token, int ntokens, int *inputp, int *outputp) {
       *outputp = Open(token[i], O_WRONLY | O_CREAT | O_APPEND, S_IRWXU);
       token[i] = T_NULL;
       mode = NULL;
+    } else if (mode == T_DUPIN || mode == T_DUPOUT) {
+      int *fdp = (mode == T_DUPIN) ? inputp : outputp;
+      MaybeClose(fdp);
+      if ((*fdp = dupfd(token[i])) < 0)
+        failed = true;
+      token[i] = T_NULL;
+      mode = NULL;
     } else {
       // zwiekszamy zwracana liczbe tokenow
       n++;
@@ -76,15 +122,51 @@ static int do_redir(token_t *token, int ntokens, int *inputp, int *outputp) {
     } else if (token[i] == T_OUTPUT) {
       mode = T_OUTPUT;
       token[i] = T_NULL;
+    } else if (token[i] == T_DUPIN || token[i] == T_DUPOUT) {
+      mode = token[i];
+      token[i] = T_NULL;
     }
 
 #endif /* !STUDENT */
   }
 
   token[n] = NULL;
+  return failed ? -1 : n;
+}
+
+/* Returns number of variable assignments preceding command name. */
+static int assignments(token_t *token, int ntokens) {
+  int n = 0;
+  while (n < ntokens && assignment_p(token[n]))
+    n++;
   return n;
 }
 
+/* Run shell function within shell's process with standard input and output
+ * temporarily redirected. */
+static int do_function(chunk_t *fn, token_t *argv, int input, int output) {
+  int saved[2] = {-1, -1};
+  int fds[2] = {input, output};
+
+  for (int i = 0; i < 2; i++) {
+    if (fds[i] < 0)
+      continue;
+    saved[i] = fcntl(i, F_DUPFD_CLOEXEC, 10);
+    Dup2(fds[i], i);
+  }
+
+  int exitcode = callfunc(fn, argv);
+
+  for (int i = 0; i < 2; i++) {
+    if (saved[i] < 0)
+      continue;
+    Dup2(saved[i], i);
+    Close(saved[i]);
+  }
+
+  return exitcode;
+}
+
 /* Execute internal command within shell's process or execute external command
  * in a subprocess. External command can be run in the background. */
 static int do_job(token_t *token, int ntokens, bool bg) {
@@ -92,18 +174,53 @@ static int do_job(token_t *token, int ntokens, bool bg) {
   int exitcode = 0;
 
   ntokens = do_redir(token, ntokens, &input, &output);
+  if (ntokens < 0) {
+    MaybeClose(&input);
+    MaybeClose(&output);
+    return 1;
+  }
+
+  int nassign = assignments(token, ntokens);
+
+  /* Command consisting of redirections and assignments only just creates
+   * files and sets shell variables. */
+  if (ntokens == nassign) {
+    for (int i = 0; i < nassign; i++)
+      setvar(token[i], false);
+    MaybeClose(&input);
+    MaybeClose(&output);
+    return substatus;
+  }
 
   if (!bg) {
-    if ((exitcode = builtin_command(token)) >= 0)
+    for (int i = 0; i < nassign; i++)
+      pushvar(token[i]);
+    chunk_t *fn = getfunc(token[nassign]);
+    if (fn)
+      exitcode = do_function(fn, token + nassign, input, output);
+    else
+      exitcode = builtin_command(token + nassign, output);
+    popvars(nassign);
+    if (exitcode >= 0) {
+      MaybeClose(&input);
+      MaybeClose(&output);
       return exitcode;
+    }
+    exitcode = 0;
   }
 
+  find_command(token[nassign]);
+
   sigset_t mask;
   Sigprocmask(SIG_BLOCK, &sigchld_mask, &mask);
 
   /* TODO: Start a subprocess, create a job and monitor it. */
 #ifdef STUDENT
-  pid_t pid = Fork();
+  pid_t pid = launch(token + nassign, token, nassign, input, output, 0, !bg);
+  if (pid < 0) {
+    metric_fork();
+    pid = Fork();
+  }
   if (pid) { // parent
     // ustawiamy pgid procesu i w rodzicu i w dziecku
     // aby nie doprowadzic do race condition
@@ -153,11 +270,19 @@ static int do_job(token_t *token, int ntokens, bool bg) {
     // odblokowujemy sygnaly sigchld i wykonujemy polecenie
     Sigprocmask(SIG_SETMASK, &mask, NULL);
 
-    external_command(token);
+    for (int i = 0; i < nassign; i++)
+      envoverride(token[i]);
+    /* Only background job gets here with a function to run. */
+    chunk_t *fn = getfunc(token[nassign]);
+    if (fn)
+      exit(callfunc(fn, token + nassign));
+    external_command(token + nassign);
   }
 #endif /* !STUDENT */
 
   Sigprocmask(SIG_SETMASK, &mask, NULL);
+  if (!bg)
+    command_done(token[nassign], exitcode);
   return exitcode;
 }
 
@@ -165,13 +290,31 @@ static int do_job(token_t *token, int ntokens, bool bg) {
  * All subprocesses in pipeline must belong to the same process group. */
 static pid_t do_stage(pid_t pgid, sigset_t *mask, int input, int output,
                       token_t *token, int ntokens, bool bg) {
-  ntokens = do_redir(token, ntokens, &input, &output);
-
-  if (ntokens == 0)
-    app_error("ERROR: Command line is not well formed!");
+  /* Descriptors opened by redirections replace pipe ends only in the child,
+   * as the pipe ends are closed by the caller. */
+  int redir_input = -1, redir_output = -1;
+  ntokens = do_redir(token, ntokens, &redir_input, &redir_output);
+
+  int nassign = assignments(token, ntokens);
+
+  /* Stage of redirections and assignments only has no command to run, but
+   * it still takes part in the pipeline as a process that succeeds. */
+  bool nocmd = ntokens <= nassign;
+
+  /* External commands are started by the launcher if it's running. */
+  pid_t pid = -1;
+  if (!nocmd) {
+    find_command(token[nassign]);
+    pid = launch(token + nassign, token, nassign,
+                 redir_input >= 0 ? redir_input : input,
+                 redir_output >= 0 ? redir_output : output, pgid, !bg);
+  }
 
   /* TODO: Start a subprocess and make sure it's moved to a process group. */
-  pid_t pid = Fork();
+  if (pid < 0) {
+    metric_fork();
+    pid = Fork();
+  }
 #ifdef STUDENT
   int exitcode = 0;
   // wiekszosc analogiczna do funkcji do_job, z tą roznica, ze
@@ -185,6 +328,8 @@ static pid_t do_stage(pid_t pgid, sigset_t *mask, int input, int output,
     if (!bg) {
       setfgpgrp(pgid);
     }
+    MaybeClose(&redir_input);
+    MaybeClose(&redir_output);
   } else { // child
     if (pgid == 0) {
       pgid = getpid();
@@ -198,6 +343,21 @@ static pid_t do_stage(pid_t pgid, sigset_t *mask, int input, int output,
     Signal(SIGTTIN, SIG_DFL);
     Signal(SIGTTOU, SIG_DFL);
 
+    /* Redirection failed, so the stage fails without running the command. */
+    if (ntokens < 0)
+      exit(EXIT_FAILURE);
+    if (nocmd)
+      exit(EXIT_SUCCESS);
+
+    if (redir_input >= 0) {
+      MaybeClose(&input);
+      input = redir_input;
+    }
+    if (redir_output >= 0) {
+      MaybeClose(&output);
+      output = redir_output;
+    }
+
     dup2((input != -1) ? input : 0, 0);
     MaybeClose(&input);
 
@@ -206,10 +366,15 @@ static pid_t do_stage(pid_t pgid, sigset_t *mask, int input, int output,
 
     Sigprocmask(SIG_SETMASK, mask, NULL);
 
-    if ((exitcode = builtin_command(token)) >= 0) {
+    for (int i = 0; i < nassign; i++)
+      envoverride(token[i]);
+    chunk_t *fn = getfunc(token[nassign]);
+    if (fn)
+      exit(callfunc(fn, token + nassign));
+    if ((exitcode = builtin_command(token + nassign, -1)) >= 0) {
       exit(exitcode);
     }
-    external_command(token);
+    external_command(token + nassign);
   }
 #endif /* !STUDENT */
 
@@ -302,6 +467,71 @@ static int do_pipeline(token_t *token, int ntokens, bool bg) {
   return exitcode;
 }
 
+static void setfdvar(const char *name, const char *suffix, int value) {
+  size_t size = strlen(name) + strlen(suffix) + 16;
+  char *assignment = Malloc(size);
+  snprintf(assignment, size, "%s%s=%d", name, suffix, value);
+  setvar(assignment, false);
+  free(assignment);
+}
+
+/* Start command as a background job connected to the shell with two pipes.
+ * The shell reads output of the coprocess from descriptor stored in NAME[0]
+ * (and NAME) variable and writes to its input using descriptor in NAME[1].
+ * The descriptors are owned by the job and closed when it's gone. */
+int coproc(const char *name, char **argv) {
+  int input, output, child_input, child_output;
+
+  mkpipe(&child_input, &output);
+  mkpipe(&input, &child_output);
+  find_command(argv[0]);
+
+  sigset_t mask;
+  Sigprocmask(SIG_BLOCK, &sigchld_mask, &mask);
+
+  metric_fork();
+  pid_t pid = Fork();
+  if (pid == 0) {
+    setpgid(0, 0);
+    Signal(SIGTSTP, SIG_DFL);
+    Signal(SIGTTIN, SIG_DFL);
+    Signal(SIGTTOU, SIG_DFL);
+
+    Dup2(child_input, STDIN_FILENO);
+    Dup2(child_output, STDOUT_FILENO);
+    Close(child_input);
+    Close(child_output);
+    Close(input);
+    Close(output);
+
+    Sigprocmask(SIG_SETMASK, &mask, NULL);
+
+    chunk_t *fn = getfunc(argv[0]);
+    if (fn)
+      exit(callfunc(fn, argv));
+    int exitcode = builtin_command(argv, -1);
+    if (exitcode >= 0)
+      exit(exitcode);
+    external_command(argv);
+  }
+
+  setpgid(pid, pid);
+  int j = addjob(pid, BG);
+  addproc(j, pid, argv);
+  addpipes(j, input, output);
+  Close(child_input);
+  Close(child_output);
+  msg("[%d] running '%s'\n", j, jobcmd(j));
+
+  Sigprocmask(SIG_SETMASK, &mask, NULL);
+
+  setfdvar(name, "", input);
+  setfdvar(name, "[0]", input);
+  setfdvar(name, "[1]", output);
+  setfdvar(name, "_PID", pid);
+  return 0;
+}
+
 static bool is_pipeline(token_t *token, int ntokens) {
   for (int i = 0; i < ntokens; i++)
     if (token[i] == T_PIPE)
@@ -309,27 +539,194 @@ static bool is_pipeline(token_t *token, int ntokens) {
   return false;
 }
 
-static void eval(char *cmdline) {
-  bool bg = false;
+/* Expand words of a command or pipeline just before it's executed,
+ * so that it sees variables assigned by preceding commands. */
+int run_command(token_t *token, int ntokens, bool bg) {
+  words_t w;
+  int status = 1;
+
+  substatus = 0;
+
+  if (expand(&w, token, ntokens)) {
+    if (is_pipeline(w.token, w.ntokens))
+      status = do_pipeline(w.token, w.ntokens, bg);
+    else
+      status = do_job(w.token, w.ntokens, bg);
+  }
+
+  freewords(&w);
+  return status;
+}
+
+/* Can command substitution run within shell's process? That's the case for
+ * lists of builtins, which do nothing but write to standard output. Nested
+ * substitutions and arithmetic could change variables, so they're excluded. */
+static bool inprocess_p(node_t *n) {
+  switch (n->type) {
+    case N_CMD:
+      if (n->bg)
+        return false;
+      for (int i = 0; i < n->ntokens; i++)
+        if (!string_p(n->token[i]) || strstr(n->token[i], "$("))
+          return false;
+      int k = assignments(n->token, n->ntokens);
+      return k < n->ntokens && builtin_pure_p(n->token[k]) &&
+             !getfunc(n->token[k]);
+    case N_NOT:
+      return inprocess_p(n->left);
+    case N_AND:
+    case N_OR:
+    case N_SEQ:
+      return inprocess_p(n->left) && inprocess_p(n->right);
+    default:
+      return false;
+  }
+}
+
+#define SUBST_PIPESIZE (1 << 20) /* try to fit whole output in the pipe */
+#define SUBST_READSIZE (1 << 16) /* minimum free space for read(2) */
+
+/* Run compiled command in a subprocess and read its standard output from
+ * a pipe. The pipe is enlarged and data is read directly into the capture
+ * buffer in big chunks. Returns exit status of the subprocess. */
+static int subshell_output(chunk_t *code, capture_t *c) {
+  int input, output;
+  mkpipe(&input, &output);
+#ifdef LINUX
+  (void)fcntl(input, F_SETPIPE_SZ, SUBST_PIPESIZE);
+#endif
+
+  metric_fork();
+  pid_t pid = Fork();
+  if (pid == 0) {
+    Close(input);
+    Dup2(output, STDOUT_FILENO);
+    Close(output);
+    (void)builtin_capture(NULL);
+    exit(run_chunk(code));
+  }
+
+  Close(output);
+
+  for (;;) {
+    if (c->size - c->len < SUBST_READSIZE) {
+      c->size = max(c->size * 2, c->len + SUBST_READSIZE);
+      c->buf = Realloc(c->buf, c->size);
+    }
+    ssize_t n = read(input, c->buf + c->len, c->size - c->len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    c->len += n;
+  }
+
+  Close(input);
+
+  int status;
+  while (waitpid(pid, &status, 0) < 0)
+    if (errno != EINTR)
+      return 1;
+  return exitstatus(status);
+}
+
+/* Run command of substitution "$(...)" appending its output to `c`.
+ * Returns false if the command is malformed. */
+bool cmdsubst(char *cmdline, capture_t *c) {
   int ntokens;
   token_t *token = tokenize(cmdline, &ntokens);
+  node_t *tree = parse(token, ntokens);
 
-  if (ntokens > 0 && token[ntokens - 1] == T_BGJOB) {
-    token[--ntokens] = NULL;
-    bg = true;
+  if (tree == NULL) {
+    free(token);
+    substatus = 0;
+    return ntokens == 0;
   }
 
-  if (ntokens > 0) {
-    if (is_pipeline(token, ntokens)) {
-      do_pipeline(token, ntokens, bg);
-    } else {
-      do_job(token, ntokens, bg);
-    }
+  bool inprocess = inprocess_p(tree);
+  chunk_t *code = compile(tree);
+  freenode(tree);
+  free(token);
+
+  int status;
+  if (inprocess) {
+    capture_t *prev = builtin_capture(c);
+    status = run_chunk(code);
+    (void)builtin_capture(prev);
+  } else {
+    status = subshell_output(code, c);
+  }
+
+  free_chunk(code);
+  substatus = status;
+  return true;
+}
+
+/* Evaluate command line within shell's process. Syntax tree is compiled and
+ * only its leaves, i.e. commands and pipelines, are executed as jobs. */
+static void eval(char *cmdline) {
+  int ntokens;
+  token_t *token = tokenize(cmdline, &ntokens);
+  node_t *tree = parse(token, ntokens);
+
+  if (tree) {
+    chunk_t *code = compile(tree);
+    freenode(tree);
+    (void)run_chunk(code);
+    free_chunk(code);
   }
 
   free(token);
 }
 
+#ifdef READLINE
+/* Replace line being edited with the most recent history entry that contains
+ * it. Pressing the key again continues search with the original pattern. */
+static int history_find(int count, int key) {
+  static char *pattern = NULL;
+  static int cursor = -1;
+
+  if (rl_last_func != history_find) {
+    free(pattern);
+    pattern = strdup(rl_line_buffer);
+    cursor = -1;
+  }
+
+  const char *cmd = hist_find(pattern, &cursor);
+  if (cmd == NULL) {
+    rl_ding();
+    return 0;
+  }
+
+  rl_replace_line(cmd, 0);
+  rl_point = rl_end;
+  return 0;
+}
+
+static char *command_generator(const char *text, int state) {
+  static int cursor;
+
+  if (state == 0) {
+    path_index(true);
+    cursor = -1;
+  }
+
+  const char *name = path_complete(text, &cursor);
+  return name ? strdup(name) : NULL;
+}
+
+/* Complete command names from PATH index when the word being completed is
+ * the first one in a command. Otherwise fall back to file name completion. */
+static char **complete(const char *text, int start, int end) {
+  int i = start;
+  while (i > 0 && isspace(rl_line_buffer[i - 1]))
+    i--;
+  if (i > 0 && !strchr("|&;!", rl_line_buffer[i - 1]))
+    return NULL;
+  return rl_completion_matches(text, command_generator);
+}
+#endif
+
 #ifndef READLINE
 static char *readline(const char *prompt) {
   static char line[MAXLINE]; /* `readline` is clearly not reentrant! */
@@ -354,21 +751,41 @@ static char *readline(const char *prompt) {
 }
 #endif
 
-int main(int argc, char *argv[]) {
-  /* `stdin` should be attached to terminal running in canonical mode */
-  if (!isatty(STDIN_FILENO))
-    app_error("ERROR: Shell can run only in interactive mode!");
-
+/* Initialization that does not depend on terminal, done once by the daemon
+ * for all sessions it serves. */
+static void init(void) {
 #ifdef READLINE
   rl_initialize();
+  /* Escape sequences around the prompt only confuse programs driving us. */
+  rl_variable_bind("enable-bracketed-paste", "off");
+  rl_bind_key(CTRL('r'), history_find);
+  rl_attempted_completion_function = complete;
 #endif
 
   sigemptyset(&sigchld_mask);
   sigaddset(&sigchld_mask, SIGCHLD);
 
+  initvars();
+  hist_init();
+}
+
+/* Run interactive session on terminal attached to standard input. */
+static int session(void) {
+  /* `stdin` should be attached to terminal running in canonical mode */
+  if (!isatty(STDIN_FILENO))
+    app_error("ERROR: Shell can run only in interactive mode!");
+
   if (getsid(0) != getpgid(0))
     Setpgid(0, 0);
 
+  if (metrics_addr)
+    metrics_open(metrics_addr);
+  if (use_launcher)
+    launcher_start();
+  if (events_path)
+    events_open(events_path);
+  if (joblog_path)
+    joblog_open(joblog_path);
   initjobs();
 
   struct sigaction act = {
@@ -391,6 +808,9 @@ int main(int argc, char *argv[]) {
 #ifdef READLINE
       add_history(line);
 #endif
+      hist_add(line);
+      path_index(false);
+      interrupted = false;
       eval(line);
     }
     free(line);
@@ -402,3 +822,114 @@ int main(int argc, char *argv[]) {
 
   return 0;
 }
+
+/* Take over terminal of a client connected to the daemon. The client sends
+ * its working directory along with descriptors of standard input, output and
+ * error, and gives up the terminal, so that we can make it controlling
+ * terminal of our new session. The connection stays open until we exit. */
+static int attach(int connfd) {
+  char cwd[PATH_MAX];
+  int fds[3], nfds = 3;
+
+  Setsid();
+  fcntl(connfd, F_SETFD, FD_CLOEXEC);
+
+  ssize_t len = recv_fds(connfd, cwd, sizeof(cwd) - 1, fds, &nfds);
+  if (len < 0)
+    unix_error("recv_fds error");
+  if (len == 0 || nfds != 3)
+    app_error("ERROR: Malformed request from client!");
+  cwd[len] = '\0';
+
+  for (int i = 0; i < 3; i++)
+    Dup2(fds[i], i);
+  for (int i = 0; i < 3; i++)
+    if (fds[i] > STDERR_FILENO)
+      Close(fds[i]);
+
+  if (ioctl(STDIN_FILENO, TIOCSCTTY, 0) < 0)
+    unix_error("TIOCSCTTY error");
+
+  if (chdir(cwd) < 0)
+    msg("cd: %s: %s\n", cwd, strerror(errno));
+
+  return session();
+}
+
+/* Serve sessions to clients connecting to UNIX domain socket at `path`.
+ * One spare session is always forked in advance and waits for a client,
+ * so shell initialization is not paid when a new terminal is opened. */
+static noreturn void serve(char *path) {
+  /* Nobody else may even connect to the socket. */
+  mode_t mask = umask(0177);
+  int listenfd = Open_unix_listenfd(path, 16);
+  umask(mask);
+  fcntl(listenfd, F_SETFD, FD_CLOEXEC);
+
+  /* Sessions are reaped automatically. */
+  Signal(SIGCHLD, SIG_IGN);
+  path_index(true);
+
+  while (true) {
+    int ready, accepted;
+    mkpipe(&ready, &accepted);
+
+    if (Fork() == 0) {
+#ifdef LINUX
+      /* Spare session must not outlive the daemon. */
+      Prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+      Close(ready);
+      int connfd = Accept(listenfd, NULL, NULL);
+#ifdef LINUX
+      Prctl(PR_SET_PDEATHSIG, 0);
+#endif
+      Close(listenfd);
+      Close(accepted); /* let the daemon fork next spare session */
+
+      /* Sessions run with our privileges, so serve only our own user. */
+      uid_t uid = -1;
+      gid_t gid;
+      if (getpeereid(connfd, &uid, &gid) < 0 || uid != geteuid()) {
+        msg("Refusing session to user %d\n", (int)uid);
+        exit(EXIT_FAILURE);
+      }
+      exit(attach(connfd));
+    }
+
+    /* Wait until the spare session gets a client or dies. */
+    Close(accepted);
+    char c;
+    while (read(ready, &c, 1) < 0 && errno == EINTR)
+      continue;
+    Close(ready);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  char *sockpath = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--launcher"))
+      use_launcher = true;
+    else if (!strcmp(argv[i], "--daemon") && i + 1 < argc)
+      sockpath = argv[++i];
+    else if (!strcmp(argv[i], "--events") && i + 1 < argc)
+      events_path = argv[++i];
+    else if (!strcmp(argv[i], "--joblog") && i + 1 < argc)
+      joblog_path = argv[++i];
+    else if (!strcmp(argv[i], "--metrics") && i + 1 < argc)
+      metrics_addr = argv[++i];
+    else
+      app_error("usage: %s [--launcher] [--events SOCKET] [--joblog FILE] "
+                "[--metrics [ADDR:]PORT] [--daemon SOCKET]",
+                argv[0]);
+  }
+
+  init();
+
+  if (sockpath)
+    serve(sockpath);
+
+  return session();
+}
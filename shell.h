@@ -2,6 +2,7 @@
 #define _SHELL_H_
 
 #include "csapp.h"
+#include "ring.h"
 
 #define msg(...) dprintf(STDERR_FILENO, __VA_ARGS__)
 
@@ -23,12 +24,130 @@ typedef char *token_t;
 #define T_INPUT ((token_t)7)
 #define T_APPEND ((token_t)8)
 #define T_BANG ((token_t)9)
+#define T_DUPOUT ((token_t)10)
+#define T_DUPIN ((token_t)11)
 #define separator_p(t) ((t) <= T_COLON)
-#define string_p(t) ((t) > T_BANG)
+#define string_p(t) ((t) > T_DUPIN)
 
 void strapp(char **dstp, const char *src);
 token_t *tokenize(char *s, int *tokc_p);
 
+/* Syntax tree node types. */
+enum {
+  N_CMD, /* simple command or pipeline */
+  N_NOT, /* negate exit status of left node */
+  N_AND, /* run right node if left one succeeded */
+  N_OR,  /* run right node if left one failed */
+  N_SEQ,   /* run left node and then right node */
+  N_IF,    /* run right node if left one succeeded, otherwise alt node */
+  N_WHILE, /* run right node as long as left one succeeds */
+  N_UNTIL, /* run right node as long as left one fails */
+  N_FOR,   /* run right node for each word in token vector */
+  N_FUNC,  /* define function with left node as its body */
+};
+
+typedef struct node {
+  int type;
+  struct node *left, *right; /* children of compound nodes */
+  struct node *alt;          /* N_IF: else branch or NULL */
+  const char *name;          /* N_FOR: loop variable, N_FUNC: function name */
+  token_t *token;            /* N_CMD: tokens of command with redirections,
+                              * N_FOR: words to iterate over */
+  int ntokens;               /* number of tokens, -1 if N_FOR has no words */
+  bool bg;                   /* N_CMD: run as background job */
+} node_t;
+
+node_t *parse(token_t *token, int ntokens);
+void freenode(node_t *n);
+
+typedef struct chunk chunk_t;
+
+chunk_t *compile(node_t *tree);
+int run_chunk(chunk_t *c);
+void free_chunk(chunk_t *c);
+chunk_t *getfunc(const char *name);
+int callfunc(chunk_t *body, char **argv);
+
+int run_command(token_t *token, int ntokens, bool bg);
+
+struct command;
+
+/* Interned string with metadata of command of that name. */
+typedef struct atom {
+  struct atom *next;             /* next entry in hash chain */
+  uint32_t hash;                 /* hash of the string */
+  int refcnt;                    /* entry is freed when it drops to zero */
+  const struct command *builtin; /* builtin command of that name */
+  chunk_t *func;                 /* body of function of that name */
+  char *path;                    /* cached location of executable */
+  unsigned pathgen;              /* version of PATH the location comes from */
+  bool pinned;                   /* table of resolved commands refers to it */
+  size_t len;                    /* length of the string */
+  char str[];                    /* the string itself */
+} atom_t;
+
+const char *intern(const char *s);
+void unintern(const char *s);
+atom_t *atom(const char *s);
+atom_t *atomof(const char *s);
+
+typedef struct {
+  char *buf;   /* captured output */
+  size_t len;  /* number of bytes captured */
+  size_t size; /* capacity of the buffer */
+} capture_t;
+
+void launcher_start(void);
+pid_t launch(char **argv, char **assign, int nassign, int input, int output,
+             pid_t pgid, bool fg);
+
+bool cmdsubst(char *cmdline, capture_t *c);
+int coproc(const char *name, char **argv);
+
+/* Set by SIGINT, makes loops and functions stop. */
+extern volatile sig_atomic_t interrupted;
+
+bool assignment_p(const char *word);
+size_t varnamelen(const char *s);
+const char *getvar(const char *name, size_t len);
+void setvar(const char *assignment, bool exported);
+void exportvar(const char *name);
+void unsetvar(const char *name);
+void setstatus(int status);
+void pushvar(const char *assignment);
+void popvars(int n);
+void pushargs(char **argv);
+void popargs(void);
+const char *posarg(int i);
+void envoverride(char *assignment);
+void initvars(void);
+
+typedef struct {
+  token_t *token; /* expanded tokens, NULL terminated */
+  int ntokens;    /* number of expanded tokens */
+  int maxtokens;  /* capacity of token vector */
+  char **strs;    /* strings allocated during expansion */
+  int nstrs;      /* number of allocated strings */
+  int maxstrs;    /* capacity of strs vector */
+} words_t;
+
+typedef struct brace brace_t;
+
+brace_t *brace_open(const char *word);
+const char *brace_next(brace_t *b);
+void brace_size(brace_t *b, size_t *countp, size_t *lenp);
+void brace_close(brace_t *b);
+
+bool arith(const char *expr, bool cached, int64_t *valuep);
+
+bool glob_p(const char *word);
+int pathglob(const char *pattern, char ***matchesp);
+
+void initwords(words_t *w);
+bool expandword(words_t *w, const char *word, bool split);
+bool expand(words_t *w, token_t *token, int ntokens);
+void freewords(words_t *w);
+
 /* Do not change those values or code will break! */
 enum {
   FG = 0, /* foreground job */
@@ -48,6 +167,7 @@ void shutdownjobs(void);
 
 int addjob(pid_t pgid, int bg);
 void addproc(int job, pid_t pid, char **argv);
+void addpipes(int job, int input, int output);
 bool killjob(int job);
 void watchjobs(int state);
 char *jobcmd(int job);
@@ -56,9 +176,90 @@ int monitorjob(sigset_t *mask);
 
 void setfgpgrp(pid_t pgid);
 
-int builtin_command(char **argv);
+/* Job life cycle events, see events.c and joblog.c. */
+enum {
+  EV_ADD,      /* job was created */
+  EV_SPAWN,    /* process was added to job */
+  EV_EXIT,     /* process finished, status is its exit status */
+  EV_STOP,     /* process stopped, status is the signal */
+  EV_CONTINUE, /* process continued */
+  EV_RESUME,   /* job resumed by fg or bg */
+  EV_KILL,     /* job killed by the shell */
+  EV_DELETE,   /* job was reaped, status is its exit status */
+  EV_COUNT,
+};
+
+void events_open(char *path);
+void jobevent(int event, int job, pid_t pgid, pid_t pid, int state, int status,
+              const char *cmd);
+
+/* Record of job log, which is a ring of records following a header,
+ * see ring.h. */
+typedef struct {
+  uint64_t seq;     /* sequence number starting from 1, stored last */
+  int64_t time_ns;  /* CLOCK_REALTIME in nanoseconds */
+  int32_t shell;    /* pid of the shell */
+  int32_t pid;      /* process the event concerns */
+  int32_t pgid;     /* process group of the job */
+  int32_t status;   /* exit status, signal number or -1 */
+  int16_t job;      /* job slot */
+  uint8_t event;    /* EV_* */
+  uint8_t state;    /* state of the process or job after the event */
+  char command[28]; /* prefix of job's command, NUL padded */
+} jlrec_t;
+
+#define JOBLOG_MAGIC 0x474f4c4a /* "JLOG" */
+#define JOBLOG_NRECS 4096
+
+typedef struct {
+  ring_hdr_t ring; /* magic is JOBLOG_MAGIC */
+  char reserved[40];
+} jlhdr_t;
+
+void joblog_open(char *path);
+void joblog(int event, int job, pid_t pgid, pid_t pid, int state, int status,
+            const char *cmd);
+
+/* Shell metrics, see metrics.c. */
+enum {
+  M_FORK,     /* processes forked */
+  M_EXEC,     /* calls to execve */
+  M_PROBE,    /* locations tried while searching PATH */
+  M_EXECFAIL, /* children that failed to execute a command */
+  M_COUNT,
+};
+
+enum {
+  H_FORKEXEC, /* time from fork to execve */
+  H_WAIT,     /* time spent waiting for a foreground job */
+  H_COUNT,
+};
+
+void metrics_open(char *addr);
+long nanotime(void);
+void metric_inc(int counter);
+void metric_observe(int hist, long ns);
+void metric_fork(void);
+void metric_exec(void);
+void metric_jobs(int running, int stopped, int finished);
+
+int exitstatus(int status);
+
+int builtin_command(char **argv, int output);
+bool builtin_pure_p(const char *name);
+capture_t *builtin_capture(capture_t *c);
+void find_command(const char *name);
+void command_done(const char *name, int status);
 noreturn void external_command(char **argv);
 
+void hist_init(void);
+void hist_add(const char *cmd);
+const char *hist_find(const char *pattern, int *cursorp);
+
+void path_index(bool create);
+const char *path_lookup(const char *name);
+const char *path_complete(const char *prefix, int *cursorp);
+
 /* Used by Sigprocmask to enter critical section protecting against SIGCHLD. */
 extern sigset_t sigchld_mask;
 
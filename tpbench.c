@@ -0,0 +1,88 @@
+#include "csapp.h"
+#include "threadpool.h"
+
+/*
+ * Throughput of the thread pool for increasing number of workers.
+ *
+ * The "flat" benchmark submits all tasks from the main thread, so workers
+ * steal from a single deque. The "tree" benchmark runs a binary tree of tasks,
+ * where each task submits its children, so tasks are spread by stealing.
+ */
+
+static threadpool_t *pool;
+static volatile unsigned sink;
+static int work = 1000; /* iterations of busy loop per task */
+
+static void spin(void) {
+  unsigned x = 0;
+  for (int i = 0; i < work; i++)
+    x = x * 1103515245 + 12345;
+  sink += x & 1;
+}
+
+static void leaf(void *arg) {
+  (void)arg;
+  spin();
+}
+
+static void node(void *arg) {
+  intptr_t depth = (intptr_t)arg;
+  spin();
+  if (depth > 0) {
+    threadpool_submit(pool, node, (void *)(depth - 1));
+    threadpool_submit(pool, node, (void *)(depth - 1));
+  }
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void bench(const char *name, int nworkers, int depth) {
+  long ntasks = (2L << depth) - 1;
+
+  pool = threadpool_create(nworkers);
+  double start = now();
+  if (!strcmp(name, "flat")) {
+    for (long i = 0; i < ntasks; i++)
+      threadpool_submit(pool, leaf, NULL);
+  } else {
+    threadpool_submit(pool, node, (void *)(intptr_t)depth);
+  }
+  threadpool_wait(pool);
+  double elapsed = now() - start;
+  threadpool_destroy(pool);
+
+  printf("%-5s %7d %10ld %12.0f %10.1f\n", name, nworkers, ntasks,
+         ntasks / elapsed, elapsed * 1e9 / ntasks);
+}
+
+int main(int argc, char *argv[]) {
+  int depth = 16;
+  int maxworkers = max(sysconf(_SC_NPROCESSORS_ONLN), 1L);
+  int opt;
+
+  while ((opt = getopt(argc, argv, "d:w:n:")) != -1) {
+    if (opt == 'd')
+      depth = atoi(optarg);
+    else if (opt == 'w')
+      work = atoi(optarg);
+    else if (opt == 'n')
+      maxworkers = atoi(optarg);
+    else
+      app_error("usage: %s [-d depth] [-w work] [-n maxworkers]", argv[0]);
+  }
+
+  printf("%-5s %7s %10s %12s %10s\n", "bench", "workers", "tasks", "tasks/s",
+         "ns/task");
+  for (int n = 1;; n = min(n * 2, maxworkers)) {
+    bench("flat", n, depth);
+    bench("tree", n, depth);
+    if (n == maxworkers)
+      break;
+  }
+
+  return 0;
+}
@@ -4,12 +4,22 @@
 #define _GNU_SOURCE
 #include <assert.h>
 #include <stdarg.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
 #include <unistd.h>
 #include <termios.h>
 #include <dlfcn.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <spawn.h>
+#include <time.h>
+
+#include "trace.h"
 
 static int (*execve_p)(const char *path, char *const argv[],
                        char *const envp[]) = NULL;
@@ -22,6 +32,32 @@ static int (*setpgid_p)(pid_t pid, pid_t pgid) = NULL;
 static int (*tcsetpgrp_p)(int fd, pid_t pgrp);
 static int (*tcsetattr_p)(int fd, int action, const struct termios *t);
 static int (*kill_p)(pid_t pid, int sig);
+static int (*pipe_p)(int fds[2]);
+static int (*pipe2_p)(int fds[2], int flags);
+static int (*dup_p)(int fd);
+static int (*clone_p)(int (*fn)(void *), void *stack, int flags, void *arg,
+                      ...);
+static int (*posix_spawn_p)(pid_t *pid, const char *path,
+                            const posix_spawn_file_actions_t *actions,
+                            const posix_spawnattr_t *attr, char *const argv[],
+                            char *const envp[]);
+static int (*posix_spawnp_p)(pid_t *pid, const char *file,
+                             const posix_spawn_file_actions_t *actions,
+                             const posix_spawnattr_t *attr, char *const argv[],
+                             char *const envp[]);
+static pid_t (*wait4_p)(pid_t pid, int *status, int options,
+                        struct rusage *rusage);
+static int (*waitid_p)(idtype_t idtype, id_t id, siginfo_t *info, int options);
+static int (*fcntl_p)(int fd, int cmd, ...);
+static pid_t (*setsid_p)(void);
+static ssize_t (*read_p)(int fd, void *buf, size_t count);
+static ssize_t (*write_p)(int fd, const void *buf, size_t count);
+
+/* <fcntl.h> declares `open` in a way that conflicts with the wrapper. */
+int fcntl(int fd, int cmd, ...);
+#ifndef F_SETPIPE_SZ
+#define F_SETPIPE_SZ 1031
+#endif
 
 static void xdlsym(const char *symbol, void **fn_p) {
   if (*fn_p == NULL) {
@@ -36,113 +72,706 @@ static void xdlsym(const char *symbol, void **fn_p) {
 
 #define LINESZ 256
 
-static __attribute__((format(printf, 1, 2))) void report(const char *fmt, ...) {
+static trace_hdr_t *ring_hdr = NULL; /* shared ring in TRACE_RING mode */
+static trace_rec_t *ring = NULL;
+
+/* Output of trace.so must not go through the wrapper of `write`. */
+static void output(const char *buf, size_t len) {
+  xdlsym("write", (void **)&write_p);
+  ssize_t n = write_p(STDERR_FILENO, buf, len);
+  assert(n == (ssize_t)len); /* Fail if write was not atomic! */
+}
+
+/* Map ring file, creating it if it does not exist. A new file is prepared
+ * under a temporary name and linked into place, so that concurrently started
+ * processes never see it uninitialized. Files are opened with stdio, which
+ * does not go through the wrappers. */
+static void ring_open(const char *path) {
+  uint32_t nrecs = TRACE_NRECS;
+  char *size = getenv("TRACE_RING_SIZE");
+  if (size && atoi(size) > 0)
+    nrecs = atoi(size);
+
+  FILE *f = fopen(path, "r+e");
+  if (f == NULL) {
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+    trace_hdr_t hdr = {.ring = {.magic = TRACE_MAGIC,
+                                .recsize = sizeof(trace_rec_t),
+                                .nrecs = nrecs}};
+    FILE *t = fopen(tmp, "wxe");
+    if (t == NULL || fwrite(&hdr, sizeof(hdr), 1, t) != 1 ||
+        ftruncate(fileno(t), sizeof(hdr) + sizeof(trace_rec_t) * nrecs) < 0 ||
+        fclose(t) < 0) {
+      perror(tmp);
+      exit(EXIT_FAILURE);
+    }
+    /* Someone else may have won the race, then use their file. */
+    (void)link(tmp, path);
+    unlink(tmp);
+    f = fopen(path, "r+e");
+  }
+
+  struct stat sb;
+  trace_hdr_t hdr;
+  if (f == NULL || fstat(fileno(f), &sb) < 0 ||
+      fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+      !ring_valid(&hdr.ring, TRACE_MAGIC, sizeof(trace_rec_t), sizeof(hdr),
+                  sb.st_size)) {
+    fprintf(stderr, "%s: not a trace ring\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  ring_hdr = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  fileno(f), 0);
+  if (ring_hdr == MAP_FAILED) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  fclose(f);
+  ring = (trace_rec_t *)(ring_hdr + 1);
+}
+
+/* Identity of the process in records is cached, since asking the kernel for
+ * it would take two extra system calls per record. Fork handler refreshes it
+ * in children. Children made by raw clone system call, like those of the
+ * shell's launcher, skip fork handlers, but the first thing they do is
+ * setpgid, which refreshes it too. Children sharing memory with the parent
+ * (CLONE_VM) are not told apart from it. */
+static pid_t self_pid, self_pgrp;
+
+static void self_reset(void) {
+  self_pid = getpid();
+  self_pgrp = getpgrp();
+}
+
+static int64_t now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/*
+ * Launch latency statistics (TRACE_STATS=1).
+ *
+ * The process that loads trace.so first sets up a shared anonymous page,
+ * which is inherited by its children until they call execve, and prints the
+ * summary when it exits. A child measures time from return of fork to entry
+ * of execve by itself. Time from execve to the first report of waitpid spans
+ * two processes, so the child leaves the time of its execve in a table keyed
+ * by its pid, where the parent picks it up.
+ */
+
+#define NBUCKETS 24 /* bucket i counts latencies of [2^i, 2^(i+1)) us */
+#define NLAUNCH 4096
+
+typedef struct {
+  const char *name;
+  uint64_t count, sum_ns, min_ns, max_ns;
+  uint64_t bucket[NBUCKETS];
+} hist_t;
+
+enum { H_FORKEXEC, H_EXECWAIT, H_TCSETPGRP, H_COUNT };
+
+typedef struct {
+  pid_t owner;            /* process that prints the summary */
+  int64_t tcsetpgrp_ns;   /* time of the last tcsetpgrp */
+  uint64_t dropped;       /* execve times that did not fit into the table */
+  hist_t hist[H_COUNT];
+  struct {
+    pid_t pid;            /* 0 if never used, -1 if free again */
+    int64_t exec_ns;
+  } launch[NLAUNCH];
+} stats_t;
+
+static stats_t *stats = NULL;
+static int64_t forked_ns; /* return of fork in this process */
+static bool show_time = false;
+
+static void observe(int h, int64_t ns) {
+  hist_t *hp = &stats->hist[h];
+  int i = 0;
+  for (int64_t us = ns / 1000; us > 1 && i < NBUCKETS - 1; us >>= 1)
+    i++;
+  __atomic_add_fetch(&hp->bucket[i], 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&hp->sum_ns, ns, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&hp->count, 1, __ATOMIC_RELAXED);
+
+  uint64_t v = __atomic_load_n(&hp->min_ns, __ATOMIC_RELAXED);
+  while ((uint64_t)ns < v && !__atomic_compare_exchange_n(
+                               &hp->min_ns, &v, ns, false, __ATOMIC_RELAXED,
+                               __ATOMIC_RELAXED))
+    continue;
+  v = __atomic_load_n(&hp->max_ns, __ATOMIC_RELAXED);
+  while ((uint64_t)ns > v && !__atomic_compare_exchange_n(
+                               &hp->max_ns, &v, ns, false, __ATOMIC_RELAXED,
+                               __ATOMIC_RELAXED))
+    continue;
+}
+
+/* Child is about to execve: measure time since fork and leave a note for
+ * the parent. */
+static void stats_exec(int64_t t) {
+  if (forked_ns) {
+    observe(H_FORKEXEC, t - forked_ns);
+    forked_ns = 0;
+  }
+
+  pid_t pid = getpid();
+  for (int n = 0, i = pid % NLAUNCH; n < NLAUNCH; n++, i = (i + 1) % NLAUNCH) {
+    pid_t p = __atomic_load_n(&stats->launch[i].pid, __ATOMIC_ACQUIRE);
+    /* Parent looks at the entry after the child is gone or stopped, so the
+     * time can be filled in after the slot is claimed. */
+    if ((p == 0 || p == -1) &&
+        __atomic_compare_exchange_n(&stats->launch[i].pid, &p, pid, false,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      stats->launch[i].exec_ns = t;
+      return;
+    }
+  }
+  __atomic_add_fetch(&stats->dropped, 1, __ATOMIC_RELAXED);
+}
+
+/* First report of waitpid for a child that called execve. */
+static void stats_wait(pid_t pid, int64_t t) {
+  for (int n = 0, i = pid % NLAUNCH; n < NLAUNCH; n++, i = (i + 1) % NLAUNCH) {
+    pid_t p = __atomic_load_n(&stats->launch[i].pid, __ATOMIC_ACQUIRE);
+    if (p == 0)
+      return;
+    if (p == pid) {
+      observe(H_EXECWAIT, t - stats->launch[i].exec_ns);
+      __atomic_store_n(&stats->launch[i].pid, -1, __ATOMIC_RELEASE);
+      return;
+    }
+  }
+}
+
+static void stats_tcsetpgrp(int64_t t) {
+  int64_t last = __atomic_exchange_n(&stats->tcsetpgrp_ns, t, __ATOMIC_RELAXED);
+  if (last)
+    observe(H_TCSETPGRP, t - last);
+}
+
+/* Print summary with write(2), since stdio of the process may be gone. */
+static void stats_print(void) {
+  pid_t pid = getpid();
+  char buf[4096];
+  int n = 0;
+
+  for (int h = 0; h < H_COUNT; h++) {
+    hist_t *hp = &stats->hist[h];
+    if (hp->count == 0)
+      continue;
+    n += snprintf(buf + n, sizeof(buf) - n,
+                  "[%d] %s: count=%lu min=%luus avg=%luus max=%luus\n", pid,
+                  hp->name, hp->count, hp->min_ns / 1000,
+                  hp->sum_ns / hp->count / 1000, hp->max_ns / 1000);
+    for (int i = 0; i < NBUCKETS && n < (int)sizeof(buf); i++)
+      if (hp->bucket[i])
+        n += snprintf(buf + n, sizeof(buf) - n,
+                      "[%d]   %8luus .. %8luus: %lu\n", pid,
+                      i ? 1UL << i : 0, 2UL << i, hp->bucket[i]);
+    if (n >= (int)sizeof(buf))
+      break;
+  }
+  if (stats->dropped && n < (int)sizeof(buf))
+    n += snprintf(buf + n, sizeof(buf) - n, "[%d] unpaired execve: %lu\n",
+                  pid, stats->dropped);
+
+  if (n > (int)sizeof(buf))
+    n = sizeof(buf);
+  if (n > 0)
+    output(buf, n);
+}
+
+/*
+ * Byte counters (TRACE_IO=1).
+ *
+ * Each process counts bytes moved by `read` and `write` through every
+ * descriptor and prints the totals when it exits or calls execve. Counters
+ * are private to the process, so a child starts from zero.
+ */
+
+#define IO_NFDS 1024
+
+typedef struct {
+  uint64_t rbytes, rcalls;
+  uint64_t wbytes, wcalls;
+} io_t;
+
+static io_t *io = NULL;
+
+static void io_reset(void) {
+  if (io)
+    memset(io, 0, sizeof(io_t) * IO_NFDS);
+}
+
+static void io_count(int fd, ssize_t n, bool writing) {
+  if (fd < 0 || fd >= IO_NFDS || n < 0)
+    return;
+  io_t *c = &io[fd];
+  __atomic_add_fetch(writing ? &c->wbytes : &c->rbytes, n, __ATOMIC_RELAXED);
+  __atomic_add_fetch(writing ? &c->wcalls : &c->rcalls, 1, __ATOMIC_RELAXED);
+}
+
+static void io_print(void) {
+  pid_t pid = getpid();
+
+  for (int fd = 0; fd < IO_NFDS; fd++) {
+    io_t *c = &io[fd];
+    if (c->rcalls == 0 && c->wcalls == 0)
+      continue;
+    char line[LINESZ];
+    int n = snprintf(line, LINESZ,
+                     "[%d] fd %d: read %lu bytes in %lu calls, "
+                     "wrote %lu bytes in %lu calls\n",
+                     pid, fd, c->rbytes, c->rcalls, c->wbytes, c->wcalls);
+    output(line, n);
+  }
+}
+
+/*
+ * Call counters (TRACE_MODE=count).
+ *
+ * Instead of reporting each call, only the number of calls and the time
+ * spent in them is kept. Every thread counts into a table of its own, so
+ * counting takes no locks and no shared cache lines. Tables are mapped on
+ * first use, which is safe in signal handlers, and are never freed, so
+ * that the destructor can sum up tables of threads that are gone.
+ */
+
+typedef struct tally {
+  struct tally *next;
+  struct {
+    uint64_t calls, ns;
+  } call[TR_NCALLS];
+} tally_t;
+
+static bool counting = false;
+static uint32_t filter = ~0U; /* bit per TR_* call to report */
+static tally_t *tallies = NULL;
+static __thread tally_t *tally = NULL;
+
+static void tally_count(int call, int64_t ns) {
+  if (tally == NULL) {
+    tally_t *t = mmap(NULL, sizeof(tally_t), PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (t == MAP_FAILED)
+      return;
+    t->next = __atomic_load_n(&tallies, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&tallies, &t->next, t, false,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      continue;
+    tally = t;
+  }
+  /* Only the owner writes, others read at exit. */
+  __atomic_store_n(&tally->call[call].calls, tally->call[call].calls + 1,
+                   __ATOMIC_RELAXED);
+  __atomic_store_n(&tally->call[call].ns, tally->call[call].ns + ns,
+                   __ATOMIC_RELAXED);
+}
+
+static void tally_reset(void) {
+  for (tally_t *t = tallies; t; t = t->next)
+    memset(t->call, 0, sizeof(t->call));
+}
+
+static void tally_print(void) {
+  pid_t pid = getpid();
+
+  for (int call = 0; call < TR_NCALLS; call++) {
+    uint64_t calls = 0, ns = 0;
+    for (tally_t *t = tallies; t; t = t->next) {
+      calls += __atomic_load_n(&t->call[call].calls, __ATOMIC_RELAXED);
+      ns += __atomic_load_n(&t->call[call].ns, __ATOMIC_RELAXED);
+    }
+    if (calls == 0)
+      continue;
+    char line[LINESZ];
+    int n = snprintf(line, LINESZ, "[%d] %s: %lu calls, %luus\n", pid,
+                     trace_calls[call], calls, ns / 1000);
+    output(line, n);
+  }
+}
+
+/* Parse comma separated list of call names. */
+static void filter_parse(const char *list) {
+  char *names = strdup(list), *save = NULL;
+
+  filter = 0;
+  for (char *name = strtok_r(names, ",", &save); name;
+       name = strtok_r(NULL, ",", &save)) {
+    int call = 0;
+    while (call < TR_NCALLS && strcmp(name, trace_calls[call]))
+      call++;
+    if (call == TR_NCALLS) {
+      fprintf(stderr, "trace.so: unknown call '%s' in TRACE_FILTER\n", name);
+      exit(EXIT_FAILURE);
+    }
+    filter |= 1U << call;
+  }
+  free(names);
+}
+
+static __attribute__((constructor)) void trace_init(void) {
+  self_reset();
+  pthread_atfork(NULL, NULL, self_reset);
+  pthread_atfork(NULL, NULL, io_reset);
+  pthread_atfork(NULL, NULL, tally_reset);
+
+  char *list = getenv("TRACE_FILTER");
+  if (list && *list)
+    filter_parse(list);
+
+  char *mode = getenv("TRACE_MODE");
+  if (mode && *mode) {
+    if (strcmp(mode, "count")) {
+      fprintf(stderr, "trace.so: unknown TRACE_MODE '%s'\n", mode);
+      exit(EXIT_FAILURE);
+    }
+    counting = true;
+  }
+
+  char *path = getenv("TRACE_RING");
+  if (path && *path)
+    ring_open(path);
+
+  char *time = getenv("TRACE_TIME");
+  show_time = time && atoi(time) > 0;
+
+  char *ioenv = getenv("TRACE_IO");
+  if (ioenv && atoi(ioenv) > 0)
+    io = calloc(IO_NFDS, sizeof(io_t));
+
+  char *st = getenv("TRACE_STATS");
+  if (st && atoi(st) > 0) {
+    stats = mmap(NULL, sizeof(stats_t), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (stats == MAP_FAILED) {
+      perror("trace.so");
+      exit(EXIT_FAILURE);
+    }
+    stats->owner = getpid();
+    stats->hist[H_FORKEXEC].name = "fork -> execve";
+    stats->hist[H_EXECWAIT].name = "execve -> waitpid";
+    stats->hist[H_TCSETPGRP].name = "tcsetpgrp -> tcsetpgrp";
+    for (int h = 0; h < H_COUNT; h++)
+      stats->hist[h].min_ns = UINT64_MAX;
+  }
+}
+
+static __attribute__((destructor)) void trace_fini(void) {
+  if (counting)
+    tally_print();
+  if (io)
+    io_print();
+  if (stats && stats->owner == getpid())
+    stats_print();
+}
+
+/* Report call that started at time `start`. */
+static void report(int call, int64_t start, int res, int64_t a0, int64_t a1,
+                   int64_t a2, const char *str) {
+  if (!(filter & (1U << call)))
+    return;
+
+  int64_t time_ns = now();
+  if (counting) {
+    tally_count(call, time_ns - start);
+    return;
+  }
+
+  trace_rec_t r = {.time_ns = time_ns,
+                   .pid = self_pid,
+                   .pgrp = self_pgrp,
+                   .call = call,
+                   .res = res,
+                   .arg = {a0, a1, a2}};
+  if (str) {
+    strncpy(r.str, str, sizeof(r.str) - 1);
+    r.str[sizeof(r.str) - 1] = '\0';
+  }
+
+  if (ring) {
+    ring_put(&ring_hdr->ring, ring, &r);
+    return;
+  }
+
   char line[LINESZ];
   int n = 0;
-  va_list args;
-  va_start(args, fmt);
-  n += snprintf(line + n, LINESZ - n, "[%d:%d] ", getpid(), getpgrp());
-  n += vsnprintf(line + n, LINESZ - n, fmt, args);
+  if (show_time)
+    n = snprintf(line, LINESZ, "%ld.%09ld ", (long)(r.time_ns / 1000000000),
+                 (long)(r.time_ns % 1000000000));
+  n += trace_format(&r, line + n, LINESZ - n);
   assert(n < LINESZ); /* Need one character to terminate string! */
   line[n++] = '\n';
-  va_end(args);
-  int m = write(STDERR_FILENO, line, n);
-  assert(m == n); /* Fail if write was not atomic! */
+  output(line, n);
 }
 
 int execve(const char *path, char *const argv[], char *const envp[]) {
   xdlsym("execve", (void **)&execve_p);
-  report("execve(\"%s\", %p, %p)", path, argv, envp);
+  int64_t start = now();
+  if (stats)
+    stats_exec(now());
+  report(TR_EXECVE, start, 0, (intptr_t)argv, (intptr_t)envp, 0, path);
+  /* Destructors do not run across execve, so print what was counted. */
+  if (counting) {
+    tally_print();
+    tally_reset();
+  }
+  if (io) {
+    io_print();
+    io_reset();
+  }
   return execve_p(path, argv, envp);
 }
 
 int fork(void) {
   xdlsym("fork", (void **)&fork_p);
+  int64_t start = now();
   pid_t child = fork_p();
+  if (child == 0)
+    forked_ns = now();
   if (child)
-    report("fork() = %d", child);
+    report(TR_FORK, start, child, 0, 0, 0, NULL);
   return child;
 }
 
-#define _SN(x) [x] = #x
+/* Child of vfork borrows the stack of its parent, so it would return from
+ * the wrapper into a frame that is gone by the time the parent resumes.
+ * Since vfork may always be implemented as fork, it is. */
+pid_t vfork(void) {
+  xdlsym("fork", (void **)&fork_p);
+  int64_t start = now();
+  pid_t child = fork_p();
+  if (child == 0)
+    forked_ns = now();
+  if (child)
+    report(TR_VFORK, start, child, 0, 0, 0, NULL);
+  return child;
+}
 
-static const char *signame[NSIG] = {
-  _SN(SIGHUP),  _SN(SIGINT),  _SN(SIGQUIT), _SN(SIGILL),  _SN(SIGTRAP),
-  _SN(SIGABRT), _SN(SIGFPE),  _SN(SIGKILL), _SN(SIGBUS),  _SN(SIGSYS),
-  _SN(SIGSEGV), _SN(SIGPIPE), _SN(SIGALRM), _SN(SIGTERM), _SN(SIGURG),
-  _SN(SIGSTOP), _SN(SIGTSTP), _SN(SIGCONT), _SN(SIGCHLD), _SN(SIGTTIN),
-  _SN(SIGTTOU), _SN(SIGPOLL), _SN(SIGXCPU), _SN(SIGXFSZ), _SN(SIGVTALRM),
-  _SN(SIGPROF), _SN(SIGUSR1), _SN(SIGUSR2), _SN(SIGWINCH)};
+int clone(int (*fn)(void *), void *stack, int flags, void *arg, ...) {
+  va_list args;
+  va_start(args, arg);
+  pid_t *ptid = va_arg(args, pid_t *);
+  void *tls = va_arg(args, void *);
+  pid_t *ctid = va_arg(args, pid_t *);
+  va_end(args);
 
-#undef _SN
+  xdlsym("clone", (void **)&clone_p);
+  int64_t start = now();
+  int res = clone_p(fn, stack, flags, arg, ptid, tls, ctid);
+  report(TR_CLONE, start, res, (intptr_t)fn, (intptr_t)stack, flags, NULL);
+  return res;
+}
+
+int posix_spawn(pid_t *pid, const char *path,
+                const posix_spawn_file_actions_t *actions,
+                const posix_spawnattr_t *attr, char *const argv[],
+                char *const envp[]) {
+  pid_t child = -1;
+  xdlsym("posix_spawn", (void **)&posix_spawn_p);
+  int64_t start = now();
+  int res = posix_spawn_p(&child, path, actions, attr, argv, envp);
+  report(TR_POSIX_SPAWN, start, res, child, (intptr_t)argv, (intptr_t)envp,
+         path);
+  if (pid)
+    *pid = child;
+  return res;
+}
+
+int posix_spawnp(pid_t *pid, const char *file,
+                 const posix_spawn_file_actions_t *actions,
+                 const posix_spawnattr_t *attr, char *const argv[],
+                 char *const envp[]) {
+  pid_t child = -1;
+  xdlsym("posix_spawnp", (void **)&posix_spawnp_p);
+  int64_t start = now();
+  int res = posix_spawnp_p(&child, file, actions, attr, argv, envp);
+  report(TR_POSIX_SPAWNP, start, res, child, (intptr_t)argv, (intptr_t)envp,
+         file);
+  if (pid)
+    *pid = child;
+  return res;
+}
 
 pid_t waitpid(pid_t pid, int *statusp, int options) {
-  int status;
+  int status = 0;
   xdlsym("waitpid", (void **)&waitpid_p);
+  int64_t start = now();
   pid = waitpid_p(pid, &status, options);
-  if (pid <= 0) {
-    report("waitpid(...) -> {}");
-  } else if (WIFCONTINUED(status)) {
-    report("waitpid(...) -> {pid=%d, status=SIGCONT}", pid);
-  } else if (WIFSTOPPED(status)) {
-    report("waitpid(...) -> {pid=%d, status=%s}", pid,
-           signame[WSTOPSIG(status)]);
-  } else if (WIFSIGNALED(status)) {
-    report("waitpid(...) -> {pid=%d, status=%s}", pid,
-           signame[WTERMSIG(status)]);
-  } else if (WIFEXITED(status)) {
-    report("waitpid(...) -> {pid=%d, status=%d}", pid, WEXITSTATUS(status));
-  }
+  if (stats && pid > 0)
+    stats_wait(pid, now());
+  report(TR_WAITPID, start, pid, status, 0, 0, NULL);
+  if (statusp)
+    *statusp = status;
+  return pid;
+}
+
+pid_t wait4(pid_t pid, int *statusp, int options, struct rusage *rusage) {
+  int status = 0;
+  xdlsym("wait4", (void **)&wait4_p);
+  int64_t start = now();
+  pid = wait4_p(pid, &status, options, rusage);
+  if (stats && pid > 0)
+    stats_wait(pid, now());
+  report(TR_WAIT4, start, pid, status, 0, 0, NULL);
   if (statusp)
     *statusp = status;
   return pid;
 }
 
+/* Translate siginfo into wait status, so it's reported as by waitpid. */
+static int wait_status(siginfo_t *info) {
+  switch (info->si_code) {
+  case CLD_EXITED:
+    return (info->si_status & 0xff) << 8;
+  case CLD_KILLED:
+  case CLD_DUMPED:
+    return info->si_status & 0x7f;
+  case CLD_STOPPED:
+  case CLD_TRAPPED:
+    return (info->si_status << 8) | 0x7f;
+  default:
+    return 0xffff; /* continued */
+  }
+}
+
+int waitid(idtype_t idtype, id_t id, siginfo_t *info, int options) {
+  xdlsym("waitid", (void **)&waitid_p);
+  int64_t start = now();
+  info->si_pid = 0;
+  int res = waitid_p(idtype, id, info, options);
+  pid_t pid = res == 0 ? info->si_pid : -1;
+  if (stats && pid > 0)
+    stats_wait(pid, now());
+  report(TR_WAITID, start, pid, pid > 0 ? wait_status(info) : 0, 0, 0, NULL);
+  return res;
+}
+
 int open(const char *pathname, int flags, mode_t mode) {
   xdlsym("open", (void **)&open_p);
+  int64_t start = now();
   int res = open_p(pathname, flags, mode);
-  report("open(\"%s\", %d, %d) = %d", pathname, flags, mode, res);
+  report(TR_OPEN, start, res, flags, mode, 0, pathname);
   return res;
 }
 
 int close(int fd) {
   xdlsym("close", (void **)&close_p);
+  int64_t start = now();
   int res = close_p(fd);
-  report("close(%d) = %d", fd, res);
+  report(TR_CLOSE, start, res, fd, 0, 0, NULL);
+  return res;
+}
+
+int dup(int fd) {
+  xdlsym("dup", (void **)&dup_p);
+  int64_t start = now();
+  int res = dup_p(fd);
+  report(TR_DUP, start, res, fd, 0, 0, NULL);
   return res;
 }
 
+int pipe(int fds[2]) {
+  xdlsym("pipe", (void **)&pipe_p);
+  int64_t start = now();
+  int res = pipe_p(fds);
+  report(TR_PIPE, start, res, res ? -1 : fds[0], res ? -1 : fds[1], 0, NULL);
+  return res;
+}
+
+int pipe2(int fds[2], int flags) {
+  xdlsym("pipe2", (void **)&pipe2_p);
+  int64_t start = now();
+  int res = pipe2_p(fds, flags);
+  report(TR_PIPE2, start, res, res ? -1 : fds[0], res ? -1 : fds[1], flags,
+         NULL);
+  return res;
+}
+
+/* Only changes of pipe capacity are reported. Argument of any command fits
+ * into a long, be it an integer or a pointer. */
+int fcntl(int fd, int cmd, ...) {
+  va_list args;
+  va_start(args, cmd);
+  long arg = va_arg(args, long);
+  va_end(args);
+
+  xdlsym("fcntl", (void **)&fcntl_p);
+  int64_t start = now();
+  int res = fcntl_p(fd, cmd, arg);
+  if (cmd == F_SETPIPE_SZ)
+    report(TR_SETPIPE_SZ, start, res, fd, arg, 0, NULL);
+  return res;
+}
+
+ssize_t read(int fd, void *buf, size_t count) {
+  xdlsym("read", (void **)&read_p);
+  ssize_t n = read_p(fd, buf, count);
+  if (io)
+    io_count(fd, n, false);
+  return n;
+}
+
+ssize_t write(int fd, const void *buf, size_t count) {
+  xdlsym("write", (void **)&write_p);
+  ssize_t n = write_p(fd, buf, count);
+  if (io)
+    io_count(fd, n, true);
+  return n;
+}
+
 int dup2(int oldfd, int newfd) {
   xdlsym("dup2", (void **)&dup2_p);
+  int64_t start = now();
   int res = dup2_p(oldfd, newfd);
-  report("dup2(%d, %d) = %d", oldfd, newfd, res);
+  report(TR_DUP2, start, res, oldfd, newfd, 0, NULL);
   return res;
 }
 
 int setpgid(pid_t pid, pid_t pgid) {
   xdlsym("setpgid", (void **)&setpgid_p);
+  int64_t start = now();
   int res = setpgid_p(pid, pgid);
-  report("setpgid(%d, %d) = %d", pid, pgid, res);
+  if (res == 0)
+    self_reset();
+  report(TR_SETPGID, start, res, pid, pgid, 0, NULL);
+  return res;
+}
+
+/* Not reported, but it moves the process to a group of its own. */
+pid_t setsid(void) {
+  xdlsym("setsid", (void **)&setsid_p);
+  pid_t res = setsid_p();
+  if (res >= 0)
+    self_reset();
   return res;
 }
 
 int kill(pid_t pid, int sig) {
   xdlsym("kill", (void **)&kill_p);
+  int64_t start = now();
   int res = kill_p(pid, sig);
-  report("kill(%d, %s) = %d", pid, signame[sig], res);
+  report(TR_KILL, start, res, pid, sig, 0, NULL);
   return res;
 }
 
 int tcsetpgrp(int fd, pid_t pgrp) {
   xdlsym("tcsetpgrp", (void **)&tcsetpgrp_p);
+  int64_t start = now();
   int res = tcsetpgrp_p(fd, pgrp);
-  report("tcsetpgrp(%d, %d) = %d", fd, pgrp, res);
+  if (stats && res == 0)
+    stats_tcsetpgrp(now());
+  report(TR_TCSETPGRP, start, res, fd, pgrp, 0, NULL);
   return res;
 }
 
 int tcsetattr(int fd, int action, const struct termios *t) {
   xdlsym("tcsetattr", (void **)&tcsetattr_p);
+  int64_t start = now();
   int res = tcsetattr_p(fd, action, t);
-  report("tcsetattr(%d, %d, %p) = %d", fd, action, t, res);
+  report(TR_TCSETATTR, start, res, fd, action, (intptr_t)t, NULL);
   return res;
 }
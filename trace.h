@@ -0,0 +1,188 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+/*
+ * Records of calls intercepted by trace.so.
+ *
+ * Each intercepted call is captured as a fixed size record holding raw
+ * arguments and the result. In text mode a record is formatted and written to
+ * standard error right away. In ring mode (TRACE_RING=FILE) it's stored in a
+ * ring kept in a shared mapping of the file, and "tracedump" formats it
+ * later with the same code, so both modes produce the same text.
+ */
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include "ring.h"
+
+enum {
+  TR_EXECVE,       /* str: path, arg: argv, envp */
+  TR_FORK,         /* res: child's pid */
+  TR_WAITPID,      /* res: pid, arg: status */
+  TR_OPEN,         /* str: pathname, arg: flags, mode */
+  TR_CLOSE,        /* arg: fd */
+  TR_DUP2,         /* arg: oldfd, newfd */
+  TR_SETPGID,      /* arg: pid, pgid */
+  TR_KILL,         /* arg: pid, sig */
+  TR_TCSETPGRP,    /* arg: fd, pgrp */
+  TR_TCSETATTR,    /* arg: fd, action, termios */
+  TR_PIPE,         /* arg: fds returned */
+  TR_PIPE2,        /* arg: fds returned, flags */
+  TR_DUP,          /* arg: fd */
+  TR_VFORK,        /* res: child's pid */
+  TR_CLONE,        /* res: child's pid, arg: fn, stack, flags */
+  TR_POSIX_SPAWN,  /* str: path, arg: child's pid, argv, envp */
+  TR_POSIX_SPAWNP, /* str: file, arg: child's pid, argv, envp */
+  TR_WAIT4,        /* res: pid, arg: status */
+  TR_WAITID,       /* res: pid, arg: status translated from siginfo */
+  TR_SETPIPE_SZ,   /* arg: fd, size */
+  TR_NCALLS,
+};
+
+/* Names accepted by TRACE_FILTER and printed by TRACE_MODE=count. */
+static const char *trace_calls[TR_NCALLS] = {
+  [TR_EXECVE] = "execve",
+  [TR_FORK] = "fork",
+  [TR_WAITPID] = "waitpid",
+  [TR_OPEN] = "open",
+  [TR_CLOSE] = "close",
+  [TR_DUP2] = "dup2",
+  [TR_SETPGID] = "setpgid",
+  [TR_KILL] = "kill",
+  [TR_TCSETPGRP] = "tcsetpgrp",
+  [TR_TCSETATTR] = "tcsetattr",
+  [TR_PIPE] = "pipe",
+  [TR_PIPE2] = "pipe2",
+  [TR_DUP] = "dup",
+  [TR_VFORK] = "vfork",
+  [TR_CLONE] = "clone",
+  [TR_POSIX_SPAWN] = "posix_spawn",
+  [TR_POSIX_SPAWNP] = "posix_spawnp",
+  [TR_WAIT4] = "wait4",
+  [TR_WAITID] = "waitid",
+  [TR_SETPIPE_SZ] = "fcntl",
+};
+
+#define TRACE_RECSIZE 256
+
+typedef struct {
+  uint64_t seq;    /* 0 while the record is being written */
+  int64_t time_ns; /* CLOCK_MONOTONIC when the call returned */
+  int32_t pid;
+  int32_t pgrp;
+  int32_t call; /* TR_* */
+  int32_t res;  /* value returned by the call */
+  int64_t arg[3];
+  char str[TRACE_RECSIZE - 56]; /* NUL terminated, possibly truncated */
+} trace_rec_t;
+
+#define TRACE_MAGIC 0x45435254 /* "TRCE" */
+#define TRACE_NRECS 65536      /* default capacity of the ring */
+
+typedef struct {
+  ring_hdr_t ring; /* magic is TRACE_MAGIC, see ring.h */
+  char reserved[TRACE_RECSIZE - sizeof(ring_hdr_t)];
+} trace_hdr_t;
+
+#define _SN(x) [x] = #x
+
+static const char *signame[NSIG] = {
+  _SN(SIGHUP),  _SN(SIGINT),  _SN(SIGQUIT), _SN(SIGILL),  _SN(SIGTRAP),
+  _SN(SIGABRT), _SN(SIGFPE),  _SN(SIGKILL), _SN(SIGBUS),  _SN(SIGSYS),
+  _SN(SIGSEGV), _SN(SIGPIPE), _SN(SIGALRM), _SN(SIGTERM), _SN(SIGURG),
+  _SN(SIGSTOP), _SN(SIGTSTP), _SN(SIGCONT), _SN(SIGCHLD), _SN(SIGTTIN),
+  _SN(SIGTTOU), _SN(SIGPOLL), _SN(SIGXCPU), _SN(SIGXFSZ), _SN(SIGVTALRM),
+  _SN(SIGPROF), _SN(SIGUSR1), _SN(SIGUSR2), _SN(SIGWINCH)};
+
+#undef _SN
+
+#define _P(x) ((void *)(intptr_t)(x))
+
+/* Format the record as a line of text without the trailing newline.
+ * Returns the length of the line, as snprintf does. The timestamp is not
+ * included, callers print it on request. */
+static inline int trace_format(const trace_rec_t *r, char *line, size_t size) {
+  int n = snprintf(line, size, "[%d:%d] ", r->pid, r->pgrp);
+  const int64_t *a = r->arg;
+  int res = r->res, status = a[0];
+
+  line += n;
+  size = size > (size_t)n ? size - n : 0;
+
+  switch (r->call) {
+  case TR_EXECVE:
+    return n + snprintf(line, size, "execve(\"%s\", %p, %p)", r->str,
+                        _P(a[0]), _P(a[1]));
+  case TR_FORK:
+    return n + snprintf(line, size, "fork() = %d", res);
+  case TR_WAITPID:
+  case TR_WAIT4:
+  case TR_WAITID: {
+    const char *fn = trace_calls[r->call];
+    if (res <= 0)
+      return n + snprintf(line, size, "%s(...) -> {}", fn);
+    if (WIFCONTINUED(status))
+      return n + snprintf(line, size, "%s(...) -> {pid=%d, status=SIGCONT}",
+                          fn, res);
+    if (WIFSTOPPED(status))
+      return n + snprintf(line, size, "%s(...) -> {pid=%d, status=%s}", fn,
+                          res, signame[WSTOPSIG(status)]);
+    if (WIFSIGNALED(status))
+      return n + snprintf(line, size, "%s(...) -> {pid=%d, status=%s}", fn,
+                          res, signame[WTERMSIG(status)]);
+    return n + snprintf(line, size, "%s(...) -> {pid=%d, status=%d}", fn, res,
+                        WEXITSTATUS(status));
+  }
+  case TR_OPEN:
+    return n + snprintf(line, size, "open(\"%s\", %d, %d) = %d", r->str,
+                        (int)a[0], (int)a[1], res);
+  case TR_CLOSE:
+    return n + snprintf(line, size, "close(%d) = %d", (int)a[0], res);
+  case TR_DUP2:
+    return n + snprintf(line, size, "dup2(%d, %d) = %d", (int)a[0], (int)a[1],
+                        res);
+  case TR_SETPGID:
+    return n + snprintf(line, size, "setpgid(%d, %d) = %d", (int)a[0],
+                        (int)a[1], res);
+  case TR_KILL:
+    return n + snprintf(line, size, "kill(%d, %s) = %d", (int)a[0],
+                        signame[a[1]], res);
+  case TR_TCSETPGRP:
+    return n + snprintf(line, size, "tcsetpgrp(%d, %d) = %d", (int)a[0],
+                        (int)a[1], res);
+  case TR_TCSETATTR:
+    return n + snprintf(line, size, "tcsetattr(%d, %d, %p) = %d", (int)a[0],
+                        (int)a[1], _P(a[2]), res);
+  case TR_PIPE:
+    return n + snprintf(line, size, "pipe([%d, %d]) = %d", (int)a[0],
+                        (int)a[1], res);
+  case TR_PIPE2:
+    return n + snprintf(line, size, "pipe2([%d, %d], %d) = %d", (int)a[0],
+                        (int)a[1], (int)a[2], res);
+  case TR_DUP:
+    return n + snprintf(line, size, "dup(%d) = %d", (int)a[0], res);
+  case TR_VFORK:
+    return n + snprintf(line, size, "vfork() = %d", res);
+  case TR_CLONE:
+    return n + snprintf(line, size, "clone(%p, %p, %#x) = %d", _P(a[0]),
+                        _P(a[1]), (int)a[2], res);
+  case TR_POSIX_SPAWN:
+  case TR_POSIX_SPAWNP:
+    return n + snprintf(line, size, "%s(%d, \"%s\", %p, %p) = %d",
+                        trace_calls[r->call], (int)a[0], r->str, _P(a[1]),
+                        _P(a[2]), res);
+  case TR_SETPIPE_SZ:
+    return n + snprintf(line, size, "fcntl(%d, F_SETPIPE_SZ, %d) = %d",
+                        (int)a[0], (int)a[1], res);
+  default:
+    return n + snprintf(line, size, "unknown(%d)", r->call);
+  }
+}
+
+#undef _P
+
+#endif /* !_TRACE_H_ */
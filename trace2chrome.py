@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+
+# Convert output of trace.so into Chrome trace-event JSON, which can be
+# opened with Perfetto (ui.perfetto.dev) or chrome://tracing.
+#
+# Each process gets a track with a span from its fork to the moment its
+# parent reaped it, named after the program it executed. Calls to execve,
+# setpgid, tcsetpgrp and kill, as well as stops and continues reported by
+# the wait family, are shown as instant events. The foreground process group
+# is shown as a counter.
+#
+# Lines should carry timestamps, i.e. come from TRACE_TIME=1 or from
+# "tracedump -t". Without them consecutive lines are one microsecond apart.
+#
+# Usage: trace2chrome.py [TRACE] > trace.json
+
+import json
+import os
+import re
+import sys
+
+LINE = re.compile(r'^(?:(\d+)\.(\d{9}) )?\[(\d+):(\d+)\] (\w+)\((.*?)\)'
+                  r'(?: = (-?\d+)| -> \{(.*)\})?\s*$')
+WAIT = re.compile(r'pid=(\d+), status=(\w+)')
+SPAWN = re.compile(r'(-?\d+), "(.*)", ')
+
+
+class Converter():
+    def __init__(self):
+        self.events = []
+        self.start = {}   # pid -> time of fork
+        self.parent = {}  # pid -> pid of parent
+        self.name = {}    # pid -> program executed
+        self.pgrp = {}    # pid -> process group
+        self.clock = 0
+
+    def instant(self, ts, pid, name, **args):
+        self.events.append({'ph': 'i', 's': 't', 'ts': ts, 'pid': pid,
+                            'tid': pid, 'name': name, 'args': args})
+
+    def spawned(self, ts, parent, child):
+        self.start[child] = ts
+        self.parent[child] = parent
+        self.pgrp[child] = self.pgrp.get(parent)
+
+    def finished(self, ts, pid, status):
+        start = self.start.pop(pid, None)
+        if start is None:
+            return
+        self.events.append({'ph': 'X', 'ts': start, 'dur': ts - start,
+                            'pid': pid, 'tid': pid,
+                            'name': self.name.get(pid, 'pid %d' % pid),
+                            'args': {'status': status,
+                                     'parent': self.parent.get(pid)}})
+
+    def line(self, line):
+        m = LINE.match(line)
+        if not m:
+            return
+        sec, nsec, pid, pgrp, call, args, res, result = m.groups()
+        if sec is not None:
+            ts = int(sec) * 1e6 + int(nsec) / 1e3
+        else:
+            self.clock += 1
+            ts = self.clock
+        pid, pgrp = int(pid), int(pgrp)
+        self.pgrp[pid] = pgrp
+        res = int(res) if res is not None else None
+
+        if call in ('fork', 'vfork', 'clone') and res and res > 0:
+            self.spawned(ts, pid, res)
+        elif call in ('posix_spawn', 'posix_spawnp') and res == 0:
+            child, path = SPAWN.match(args).groups()
+            self.spawned(ts, pid, int(child))
+            self.name[int(child)] = os.path.basename(path)
+            self.instant(ts, int(child), 'execve', path=path)
+        elif call == 'execve':
+            path = args.split('", ')[0].lstrip('"')
+            self.name[pid] = os.path.basename(path)
+            self.instant(ts, pid, 'execve', path=path)
+        elif call in ('waitpid', 'wait4', 'waitid') and result:
+            w = WAIT.match(result)
+            if not w:
+                return
+            child, status = int(w.group(1)), w.group(2)
+            if status in ('SIGCONT', 'SIGSTOP', 'SIGTSTP', 'SIGTTIN',
+                          'SIGTTOU'):
+                self.instant(ts, child, status)
+            else:
+                self.finished(ts, child, status)
+        elif call == 'setpgid':
+            target, group = [int(a) for a in args.split(', ')]
+            target = target or pid
+            self.pgrp[target] = group or target
+            self.instant(ts, pid, 'setpgid', process=target, pgid=group)
+        elif call == 'tcsetpgrp':
+            group = int(args.split(', ')[1])
+            self.instant(ts, pid, 'tcsetpgrp', pgrp=group)
+            self.events.append({'ph': 'C', 'ts': ts, 'pid': pid,
+                                'name': 'foreground', 'args': {'pgrp': group}})
+        elif call == 'kill':
+            target, sig = args.split(', ')
+            target = int(target)
+            self.instant(ts, pid, 'kill', target=target, signal=sig)
+            if target > 0:
+                victims = [target]
+            else:
+                victims = [p for p, g in self.pgrp.items()
+                           if g == -target and p in self.start]
+            for victim in victims:
+                self.instant(ts, victim, sig, sender=pid)
+
+    def finish(self):
+        # Processes still running at the end of the trace.
+        end = max((e['ts'] for e in self.events), default=0)
+        for pid in list(self.start):
+            self.finished(end, pid, 'running')
+        for pid, name in self.name.items():
+            self.events.append({'ph': 'M', 'pid': pid, 'name': 'process_name',
+                                'args': {'name': '%s %d' % (name, pid)}})
+        return {'traceEvents': self.events, 'displayTimeUnit': 'ms'}
+
+
+if __name__ == '__main__':
+    conv = Converter()
+    with (open(sys.argv[1]) if len(sys.argv) > 1 else sys.stdin) as f:
+        for line in f:
+            conv.line(line)
+    json.dump(conv.finish(), sys.stdout)
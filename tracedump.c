@@ -0,0 +1,65 @@
+#include "csapp.h"
+#include "trace.h"
+
+/*
+ * Decoder of trace ring written by trace.so with TRACE_RING=FILE.
+ *
+ * Prints records in the order calls were made, in the same format as
+ * trace.so prints them in text mode. With "-t" each line is prefixed with
+ * CLOCK_MONOTONIC time of the call. With "-f" keeps watching the ring and
+ * prints new records as they appear. Records overwritten before they were
+ * read are reported as lost, and those left unfinished by a process that
+ * died as incomplete.
+ */
+
+static bool follow = false;
+static bool show_time = false;
+
+static void print(const void *rec) {
+  char line[512];
+  const trace_rec_t *r = rec;
+
+  trace_format(r, line, sizeof(line));
+  if (show_time)
+    printf("%ld.%09ld ", (long)(r->time_ns / 1000000000),
+           (long)(r->time_ns % 1000000000));
+  puts(line);
+}
+
+int main(int argc, char *argv[]) {
+  int opt;
+
+  while ((opt = getopt(argc, argv, "ft")) != -1) {
+    if (opt == 'f')
+      follow = true;
+    else if (opt == 't')
+      show_time = true;
+    else
+      app_error("usage: %s [-f] [-t] FILE", argv[0]);
+  }
+  if (optind + 1 != argc)
+    app_error("usage: %s [-f] [-t] FILE", argv[0]);
+
+  int fd = Open(argv[optind], O_RDONLY, 0);
+  struct stat sb;
+  Fstat(fd, &sb);
+  if ((size_t)sb.st_size < sizeof(trace_hdr_t))
+    app_error("%s: not a trace ring", argv[optind]);
+  trace_hdr_t *hdr = Mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  Close(fd);
+
+  if (!ring_valid(&hdr->ring, TRACE_MAGIC, sizeof(trace_rec_t),
+                  sizeof(trace_hdr_t), sb.st_size))
+    app_error("%s: not a trace ring", argv[optind]);
+
+  ring_reader_t rd = {.hdr = &hdr->ring, .recs = hdr + 1, .next = 1};
+  while (true) {
+    ring_dump(&rd, follow, print);
+    if (!follow)
+      break;
+    struct timespec ts = {.tv_sec = 0, .tv_nsec = 100000000};
+    nanosleep(&ts, NULL);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,291 @@
+#include "shell.h"
+
+/*
+ * Shell variables.
+ *
+ * Each variable is stored as a single "name=value" string. Exported variables
+ * are additionally referenced from `envp` array, which `environ` points to, so
+ * both execve and getenv see it. The array is maintained incrementally and is
+ * never rebuilt: changing a value replaces one pointer, exporting appends an
+ * entry and unsetting moves the last entry into the hole.
+ *
+ * Assignments that prefix a command are applied by `envoverride` in the child
+ * process after fork. Only the pointers that change are written, so the child
+ * copies at most a page of the array instead of the whole environment.
+ */
+
+#define NBUCKETS 256
+#define ENVSLACK 16 /* free slots left in envp for command prefixes */
+
+typedef struct var {
+  struct var *next; /* next variable in hash chain */
+  char *entry;      /* "name=value" */
+  size_t namelen;   /* length of name part of entry */
+  int envidx;       /* index in envp or -1 if variable is not exported */
+} var_t;
+
+typedef struct {
+  char *name;    /* name of variable overridden by command prefix */
+  char *entry;   /* its previous "name=value" or NULL if it was not set */
+  bool exported; /* was it exported? */
+} saved_t;
+
+static var_t *buckets[NBUCKETS];
+static saved_t *saved = NULL; /* variables overridden for a builtin */
+static int nsaved = 0;
+
+typedef struct {
+  char **argv; /* positional parameters, NULL terminated */
+  int argc;    /* number of positional parameters */
+} args_t;
+
+static args_t args = {NULL, 0};
+static args_t *savedargs = NULL; /* positional parameters of callers */
+static int nsavedargs = 0;
+static char **envp = NULL; /* exported variables, NULL terminated */
+static int nenv = 0;       /* number of entries in envp */
+static int maxenv = 0;     /* capacity of envp not counting terminator */
+static int laststatus = 0; /* value of $? */
+
+static var_t **lookup(const char *name, size_t len) {
+  var_t **vp = &buckets[jenkins_strhash(name, len) % NBUCKETS];
+  for (; *vp; vp = &(*vp)->next) {
+    var_t *v = *vp;
+    if (v->namelen == len && !strncmp(v->entry, name, len))
+      break;
+  }
+  return vp;
+}
+
+static void growenv(int n) {
+  if (n + ENVSLACK <= maxenv)
+    return;
+  maxenv = max(maxenv * 2, n + ENVSLACK);
+  envp = Realloc(envp, sizeof(char *) * (maxenv + 1));
+  environ = envp;
+}
+
+static void envappend(char *entry) {
+  growenv(nenv + 1);
+  envp[nenv++] = entry;
+  envp[nenv] = NULL;
+}
+
+static void export(var_t *v) {
+  if (v->envidx >= 0)
+    return;
+  v->envidx = nenv;
+  envappend(v->entry);
+}
+
+static void unexport(var_t *v) {
+  if (v->envidx < 0)
+    return;
+  /* Fill the hole with last entry and fix index of its variable. */
+  char *last = envp[--nenv];
+  envp[v->envidx] = last;
+  envp[nenv] = NULL;
+  if (last != v->entry) {
+    var_t *w = *lookup(last, strcspn(last, "="));
+    w->envidx = v->envidx;
+  }
+  v->envidx = -1;
+}
+
+/* Returns true if word has form of variable assignment, i.e. "name=...". */
+bool assignment_p(const char *word) {
+  if (!string_p(word) || !(isalpha(*word) || *word == '_'))
+    return false;
+  while (isalnum(*word) || *word == '_')
+    word++;
+  return *word == '=';
+}
+
+/* Returns length of the longest prefix of `s` that is a valid name. */
+size_t varnamelen(const char *s) {
+  size_t n = 0;
+  if (isalpha(s[0]) || s[0] == '_')
+    for (n = 1; isalnum(s[n]) || s[n] == '_'; n++)
+      continue;
+  return n;
+}
+
+/* Returns value of variable or NULL if it's not set. */
+const char *getvar(const char *name, size_t len) {
+  static char buf[16];
+
+  if (len == 1 && *name == '?') {
+    snprintf(buf, sizeof(buf), "%d", laststatus);
+    return buf;
+  }
+
+  if (len == 1 && *name == '$') {
+    snprintf(buf, sizeof(buf), "%d", getpid());
+    return buf;
+  }
+
+  if (len == 1 && *name == '#') {
+    snprintf(buf, sizeof(buf), "%d", args.argc);
+    return buf;
+  }
+
+  if (len == 1 && (*name == '@' || *name == '*')) {
+    static char *all = NULL;
+    free(all);
+    all = NULL;
+    for (int i = 0; i < args.argc; i++) {
+      if (i > 0)
+        strapp(&all, " ");
+      strapp(&all, args.argv[i]);
+    }
+    return all ? all : "";
+  }
+
+  if (isdigit(*name)) {
+    int i = 0;
+    for (size_t k = 0; k < len && i <= args.argc; k++)
+      i = i * 10 + name[k] - '0';
+    return (i == 0) ? "shell" : posarg(i);
+  }
+
+  var_t *v = *lookup(name, len);
+  return v ? v->entry + v->namelen + 1 : NULL;
+}
+
+/* Set variable given an assignment of form "name=value". */
+void setvar(const char *assignment, bool exported) {
+  size_t len = strcspn(assignment, "=");
+  var_t **vp = lookup(assignment, len);
+  var_t *v = *vp;
+
+  if (v == NULL) {
+    v = Malloc(sizeof(var_t));
+    v->next = NULL;
+    v->namelen = len;
+    v->envidx = -1;
+    v->entry = NULL;
+    *vp = v;
+  }
+
+  free(v->entry);
+  v->entry = strdup(assignment);
+  if (v->envidx >= 0)
+    envp[v->envidx] = v->entry;
+  if (exported)
+    export(v);
+}
+
+/* Mark variable as exported, creating it if necessary. */
+void exportvar(const char *name) {
+  var_t *v = *lookup(name, strlen(name));
+
+  if (v == NULL) {
+    char *assignment = NULL;
+    strapp(&assignment, name);
+    strapp(&assignment, "=");
+    setvar(assignment, true);
+    free(assignment);
+  } else {
+    export(v);
+  }
+}
+
+void unsetvar(const char *name) {
+  var_t **vp = lookup(name, strlen(name));
+  var_t *v = *vp;
+
+  if (v == NULL)
+    return;
+
+  unexport(v);
+  *vp = v->next;
+  free(v->entry);
+  free(v);
+}
+
+void setstatus(int status) {
+  laststatus = status;
+}
+
+/* Apply command prefix assignment for duration of a builtin command.
+ * Previous value is restored by `popvars`. */
+void pushvar(const char *assignment) {
+  size_t len = strcspn(assignment, "=");
+  var_t *v = *lookup(assignment, len);
+
+  saved = Realloc(saved, sizeof(saved_t) * (nsaved + 1));
+  saved[nsaved++] = (saved_t){
+    .name = strndup(assignment, len),
+    .entry = v ? strdup(v->entry) : NULL,
+    .exported = v && v->envidx >= 0,
+  };
+
+  setvar(assignment, true);
+}
+
+/* Restore `n` variables most recently overridden by `pushvar`. */
+void popvars(int n) {
+  for (; n > 0 && nsaved > 0; n--) {
+    saved_t *s = &saved[--nsaved];
+    unsetvar(s->name);
+    if (s->entry)
+      setvar(s->entry, s->exported);
+    free(s->name);
+    free(s->entry);
+  }
+}
+
+/* Set positional parameters for duration of a function call. */
+void pushargs(char **argv) {
+  savedargs = Realloc(savedargs, sizeof(args_t) * (nsavedargs + 1));
+  savedargs[nsavedargs++] = args;
+
+  int argc = 0;
+  while (argv[argc])
+    argc++;
+
+  args.argv = Malloc(sizeof(char *) * (argc + 1));
+  for (int i = 0; i < argc; i++)
+    args.argv[i] = strdup(argv[i]);
+  args.argv[argc] = NULL;
+  args.argc = argc;
+}
+
+void popargs(void) {
+  for (int i = 0; i < args.argc; i++)
+    free(args.argv[i]);
+  free(args.argv);
+  args = savedargs[--nsavedargs];
+}
+
+/* Returns positional parameter number `i` (counting from 1) or NULL. */
+const char *posarg(int i) {
+  return (i >= 1 && i <= args.argc) ? args.argv[i - 1] : NULL;
+}
+
+/* Apply command prefix assignment to environment of child process.
+ * Must be called after fork, as it shares `assignment` string with envp. */
+void envoverride(char *assignment) {
+  var_t *v = *lookup(assignment, strcspn(assignment, "="));
+
+  if (v && v->envidx >= 0)
+    envp[v->envidx] = assignment;
+  else
+    envappend(assignment);
+}
+
+/* Called just at the beginning of shell's life. Imports the environment. */
+void initvars(void) {
+  char **ep = environ;
+  int n = 0;
+
+  while (ep[n])
+    n++;
+
+  growenv(n);
+  envp[0] = NULL;
+
+  for (; *ep; ep++)
+    if (strchr(*ep, '='))
+      setvar(*ep, true);
+}
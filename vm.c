@@ -0,0 +1,539 @@
+#include "shell.h"
+
+/*
+ * Compiler of syntax trees into bytecode and its interpreter.
+ *
+ * A command line is parsed and compiled once. Control flow of lists, loops and
+ * conditionals becomes jumps over a flat array of instructions, so repeated
+ * execution of a loop body does not tokenize, parse nor allocate tree nodes.
+ * Leaves of the tree, i.e. simple commands and pipelines, are kept as token
+ * vectors and executed with `run_command`, which expands words and starts jobs.
+ *
+ * A chunk of bytecode owns copies of all strings it refers to, so function
+ * bodies outlive the command line they were defined in. Chunks are reference
+ * counted, as a function may be redefined while it's being executed.
+ */
+
+enum {
+  OP_CMD,     /* leaf: run command, set status */
+  OP_NOT,     /* negate status */
+  OP_STATUS,  /* value: set status */
+  OP_JMP,     /* addr: jump unconditionally */
+  OP_JZ,      /* addr: jump if status is zero */
+  OP_JNZ,     /* addr: jump if status is not zero */
+  OP_LOOP,    /* push frame of while or until loop */
+  OP_FOR,     /* loop: push frame of for loop */
+  OP_NEXT,    /* addr: assign next word to loop variable or jump if none */
+  OP_SAVE,    /* remember status as the result of innermost loop */
+  OP_ENDLOOP, /* pop loop frame and set status to the result of loop */
+  OP_DEFUN,   /* func: define function */
+  OP_RETURN,  /* leaf: leave function with status given by argument */
+  OP_BADJUMP, /* leaf: report invalid count of break or continue */
+  OP_HALT,    /* end of chunk */
+};
+
+#define MAXDEPTH 1000 /* limit of function call nesting */
+
+typedef struct {
+  token_t *token; /* command with redirections, NULL terminated */
+  int ntokens;
+  bool bg; /* run as background job */
+} leaf_t;
+
+typedef struct {
+  char *name;     /* loop variable */
+  token_t *words; /* words to iterate over or NULL for positional parameters */
+  int nwords;
+} forloop_t;
+
+typedef struct {
+  char *name;
+  chunk_t *body;
+} fundef_t;
+
+struct chunk {
+  int refcnt;
+  int *code; /* instructions followed by their operands */
+  int ncode;
+  int maxcode;
+  leaf_t *leaves;
+  int nleaves;
+  forloop_t *loops;
+  int nloops;
+  fundef_t *funcs; /* functions defined in this chunk */
+  int nfuncs;
+  char **strs; /* strings owned by the chunk */
+  int nstrs;
+};
+
+/* Loop being compiled, target of break and continue. */
+typedef struct {
+  int cont;    /* address of the next iteration */
+  int *breaks; /* operands of jumps to be patched with the end of loop */
+  int nbreaks;
+} label_t;
+
+typedef struct {
+  chunk_t *chunk;
+  label_t *loops; /* enclosing loops, innermost last */
+  int nloops;
+} compiler_t;
+
+/* Loop being executed. */
+typedef struct {
+  forloop_t *loop; /* NULL for while and until loops */
+  int status;      /* status of the last iteration */
+  int next;        /* index of the next word to expand */
+  brace_t *brace;  /* brace expansion of the current word */
+  words_t words;   /* fields of the current word */
+  int pos;         /* next field to assign */
+} frame_t;
+
+static frame_t *frames = NULL;
+static int nframes = 0;
+static int maxframes = 0;
+static int depth = 0; /* function call nesting */
+
+static int emit(chunk_t *c, int word) {
+  if (c->ncode == c->maxcode) {
+    c->maxcode = c->maxcode ? c->maxcode * 2 : 64;
+    c->code = Realloc(c->code, sizeof(int) * c->maxcode);
+  }
+  c->code[c->ncode] = word;
+  return c->ncode++;
+}
+
+/* Strings are interned, so chunks share words and command names used in
+ * leaves refer to entries with cached metadata. */
+static char *ownstr(chunk_t *c, const char *s) {
+  c->strs = Realloc(c->strs, sizeof(char *) * (c->nstrs + 1));
+  return c->strs[c->nstrs++] = (char *)intern(s);
+}
+
+static token_t *owntokens(chunk_t *c, token_t *token, int ntokens) {
+  token_t *copy = Malloc(sizeof(token_t) * (ntokens + 1));
+  for (int i = 0; i < ntokens; i++)
+    copy[i] = string_p(token[i]) ? ownstr(c, token[i]) : token[i];
+  copy[ntokens] = T_NULL;
+  return copy;
+}
+
+static int addleaf(chunk_t *c, node_t *n) {
+  c->leaves = Realloc(c->leaves, sizeof(leaf_t) * (c->nleaves + 1));
+  c->leaves[c->nleaves] = (leaf_t){
+    .token = owntokens(c, n->token, n->ntokens),
+    .ntokens = n->ntokens,
+    .bg = n->bg,
+  };
+  return c->nleaves++;
+}
+
+/* Is node a simple command consisting of given builtin and at most one
+ * argument? Returns the argument through `argp`. */
+static bool special_p(node_t *n, const char *name, const char **argp) {
+  if (n->type != N_CMD || n->bg || n->ntokens > 2)
+    return false;
+  for (int i = 0; i < n->ntokens; i++)
+    if (!string_p(n->token[i]))
+      return false;
+  if (strcmp(n->token[0], name))
+    return false;
+  *argp = (n->ntokens > 1) ? n->token[1] : NULL;
+  return true;
+}
+
+/* Compile "break n" or "continue n" with a literal count of loops. */
+static bool compile_jump(compiler_t *cc, node_t *n) {
+  chunk_t *c = cc->chunk;
+  const char *arg;
+  bool brk;
+
+  if (special_p(n, "break", &arg))
+    brk = true;
+  else if (special_p(n, "continue", &arg))
+    brk = false;
+  else
+    return false;
+
+  /* Count must be a literal, so it's rejected at run time if it's not. */
+  if (arg && (!*arg || arg[strspn(arg, "0123456789")] || atoi(arg) < 1)) {
+    emit(c, OP_BADJUMP);
+    emit(c, addleaf(c, n));
+    return true;
+  }
+
+  int count = arg ? atoi(arg) : 1;
+  if (cc->nloops == 0) {
+    emit(c, OP_STATUS);
+    emit(c, 0);
+    return true;
+  }
+  count = min(count, cc->nloops);
+
+  /* Frames of inner loops that are left must be popped. */
+  for (int i = 1; i < count; i++)
+    emit(c, OP_ENDLOOP);
+
+  label_t *l = &cc->loops[cc->nloops - count];
+  if (brk) {
+    /* Loop left with break succeeds. */
+    emit(c, OP_STATUS);
+    emit(c, 0);
+    emit(c, OP_SAVE);
+  }
+  emit(c, OP_JMP);
+  if (brk) {
+    l->breaks = Realloc(l->breaks, sizeof(int) * (l->nbreaks + 1));
+    l->breaks[l->nbreaks++] = emit(c, 0);
+  } else {
+    emit(c, l->cont);
+  }
+  return true;
+}
+
+static void compile_node(compiler_t *cc, node_t *n);
+
+/* Compile loop body and the jump back to `cont`. Operand `leave` of the jump
+ * out of the loop and break statements are patched with the end of loop. */
+static void compile_body(compiler_t *cc, node_t *body, int cont, int leave) {
+  chunk_t *c = cc->chunk;
+
+  cc->loops = Realloc(cc->loops, sizeof(label_t) * (cc->nloops + 1));
+  cc->loops[cc->nloops++] = (label_t){.cont = cont};
+
+  compile_node(cc, body);
+  emit(c, OP_SAVE);
+  emit(c, OP_JMP);
+  emit(c, cont);
+
+  label_t *l = &cc->loops[--cc->nloops];
+  c->code[leave] = c->ncode;
+  for (int i = 0; i < l->nbreaks; i++)
+    c->code[l->breaks[i]] = c->ncode;
+  free(l->breaks);
+
+  emit(c, OP_ENDLOOP);
+}
+
+static chunk_t *compile_chunk(node_t *tree);
+
+static void compile_node(compiler_t *cc, node_t *n) {
+  chunk_t *c = cc->chunk;
+  int jump, end, top;
+  const char *arg;
+
+  switch (n->type) {
+    case N_CMD:
+      if (compile_jump(cc, n))
+        break;
+      emit(c, special_p(n, "return", &arg) ? OP_RETURN : OP_CMD);
+      emit(c, addleaf(c, n));
+      break;
+
+    case N_NOT:
+      compile_node(cc, n->left);
+      emit(c, OP_NOT);
+      break;
+
+    case N_AND:
+    case N_OR:
+      compile_node(cc, n->left);
+      emit(c, (n->type == N_AND) ? OP_JNZ : OP_JZ);
+      jump = emit(c, 0);
+      compile_node(cc, n->right);
+      c->code[jump] = c->ncode;
+      break;
+
+    case N_SEQ:
+      compile_node(cc, n->left);
+      compile_node(cc, n->right);
+      break;
+
+    case N_IF:
+      compile_node(cc, n->left);
+      emit(c, OP_JNZ);
+      jump = emit(c, 0);
+      compile_node(cc, n->right);
+      emit(c, OP_JMP);
+      end = emit(c, 0);
+      c->code[jump] = c->ncode;
+      if (n->alt) {
+        compile_node(cc, n->alt);
+      } else {
+        emit(c, OP_STATUS);
+        emit(c, 0);
+      }
+      c->code[end] = c->ncode;
+      break;
+
+    case N_WHILE:
+    case N_UNTIL:
+      emit(c, OP_LOOP);
+      top = c->ncode;
+      compile_node(cc, n->left);
+      emit(c, (n->type == N_WHILE) ? OP_JNZ : OP_JZ);
+      jump = emit(c, 0);
+      compile_body(cc, n->right, top, jump);
+      break;
+
+    case N_FOR:
+      c->loops = Realloc(c->loops, sizeof(forloop_t) * (c->nloops + 1));
+      c->loops[c->nloops] = (forloop_t){
+        .name = ownstr(c, n->name),
+        .words = (n->ntokens >= 0) ? owntokens(c, n->token, n->ntokens) : NULL,
+        .nwords = n->ntokens,
+      };
+      emit(c, OP_FOR);
+      emit(c, c->nloops++);
+      top = emit(c, OP_NEXT);
+      jump = emit(c, 0);
+      compile_body(cc, n->right, top, jump);
+      break;
+
+    case N_FUNC:
+      c->funcs = Realloc(c->funcs, sizeof(fundef_t) * (c->nfuncs + 1));
+      c->funcs[c->nfuncs] = (fundef_t){
+        .name = ownstr(c, n->name),
+        .body = compile_chunk(n->left),
+      };
+      emit(c, OP_DEFUN);
+      emit(c, c->nfuncs++);
+      break;
+  }
+}
+
+static chunk_t *compile_chunk(node_t *tree) {
+  chunk_t *c = Calloc(1, sizeof(chunk_t));
+  compiler_t cc = {.chunk = c};
+
+  c->refcnt = 1;
+  compile_node(&cc, tree);
+  emit(c, OP_HALT);
+  free(cc.loops);
+  return c;
+}
+
+/* Compile syntax tree. The result does not refer to the tree or its tokens. */
+chunk_t *compile(node_t *tree) {
+  return compile_chunk(tree);
+}
+
+void free_chunk(chunk_t *c) {
+  if (c == NULL || --c->refcnt > 0)
+    return;
+  for (int i = 0; i < c->nleaves; i++)
+    free(c->leaves[i].token);
+  for (int i = 0; i < c->nloops; i++)
+    free(c->loops[i].words);
+  for (int i = 0; i < c->nfuncs; i++)
+    free_chunk(c->funcs[i].body);
+  for (int i = 0; i < c->nstrs; i++)
+    unintern(c->strs[i]);
+  free(c->leaves);
+  free(c->loops);
+  free(c->funcs);
+  free(c->strs);
+  free(c->code);
+  free(c);
+}
+
+/* Functions are attached to interned entries of their names. */
+chunk_t *getfunc(const char *name) {
+  atom_t *a = atom(name);
+  return a ? a->func : NULL;
+}
+
+static void setfunc(const char *name, chunk_t *body) {
+  atom_t *a = atomof(intern(name));
+
+  body->refcnt++;
+
+  if (a->func) {
+    free_chunk(a->func);
+    unintern(a->str); /* entry is referenced once by a function already */
+  }
+  a->func = body;
+}
+
+static void pushframe(forloop_t *loop) {
+  if (nframes == maxframes) {
+    maxframes = maxframes ? maxframes * 2 : 16;
+    frames = Realloc(frames, sizeof(frame_t) * maxframes);
+  }
+  frame_t *f = &frames[nframes++];
+  *f = (frame_t){.loop = loop};
+  initwords(&f->words);
+}
+
+static int popframe(void) {
+  frame_t *f = &frames[--nframes];
+  brace_close(f->brace);
+  freewords(&f->words);
+  return f->status;
+}
+
+/* Returns next word of for loop or NULL if there are no more. Words are
+ * expanded one at a time, so a long sequence is never held in memory. */
+static const char *nextword(frame_t *f) {
+  forloop_t *loop = f->loop;
+
+  if (loop->words == NULL)
+    return posarg(++f->next);
+
+  while (f->pos == f->words.ntokens) {
+    freewords(&f->words);
+    initwords(&f->words);
+    f->pos = 0;
+
+    const char *word = f->brace ? brace_next(f->brace) : NULL;
+    if (word == NULL) {
+      brace_close(f->brace);
+      f->brace = NULL;
+      if (f->next == loop->nwords)
+        return NULL;
+      token_t tok = loop->words[f->next++];
+      if ((f->brace = brace_open(tok)))
+        continue;
+      word = tok;
+    }
+
+    if (!expandword(&f->words, word, true))
+      return NULL;
+  }
+
+  return f->words.token[f->pos++];
+}
+
+static void setloopvar(const char *name, const char *value) {
+  static char *buf = NULL;
+  static size_t size = 0;
+  size_t len = strlen(name) + strlen(value) + 2;
+
+  if (len > size) {
+    size = max(size * 2, len);
+    buf = Realloc(buf, size);
+  }
+  snprintf(buf, size, "%s=%s", name, value);
+  setvar(buf, false);
+}
+
+static int do_return(leaf_t *leaf, int status) {
+  words_t w;
+
+  if (expand(&w, leaf->token, leaf->ntokens) && w.ntokens > 1)
+    status = atoi(w.token[1]) & 255;
+  freewords(&w);
+  return status;
+}
+
+static int exec(chunk_t *c) {
+  int base = nframes;
+  int status = 0;
+  int pc = 0;
+
+  c->refcnt++;
+
+  while (!interrupted) {
+    int op = c->code[pc++];
+
+    switch (op) {
+      case OP_CMD: {
+        leaf_t *leaf = &c->leaves[c->code[pc++]];
+        status = run_command(leaf->token, leaf->ntokens, leaf->bg);
+        /* Stop loops if a foreground job was interrupted. */
+        if (status == 128 + SIGINT)
+          interrupted = true;
+        break;
+      }
+      case OP_NOT:
+        status = !status;
+        break;
+      case OP_STATUS:
+        status = c->code[pc++];
+        break;
+      case OP_JMP:
+        pc = c->code[pc];
+        continue;
+      case OP_JZ:
+        pc = (status == 0) ? c->code[pc] : pc + 1;
+        continue;
+      case OP_JNZ:
+        pc = (status != 0) ? c->code[pc] : pc + 1;
+        continue;
+      case OP_LOOP:
+        pushframe(NULL);
+        continue;
+      case OP_FOR:
+        pushframe(&c->loops[c->code[pc++]]);
+        continue;
+      case OP_NEXT: {
+        frame_t *f = &frames[nframes - 1];
+        const char *word = nextword(f);
+        if (word == NULL) {
+          pc = c->code[pc];
+        } else {
+          setloopvar(f->loop->name, word);
+          pc++;
+        }
+        continue;
+      }
+      case OP_SAVE:
+        frames[nframes - 1].status = status;
+        continue;
+      case OP_ENDLOOP:
+        status = popframe();
+        break;
+      case OP_DEFUN: {
+        fundef_t *fn = &c->funcs[c->code[pc++]];
+        setfunc(fn->name, fn->body);
+        status = 0;
+        break;
+      }
+      case OP_RETURN:
+        status = do_return(&c->leaves[c->code[pc++]], status);
+        goto done;
+      case OP_BADJUMP: {
+        token_t *token = c->leaves[c->code[pc++]].token;
+        if (isdigit((unsigned char)token[1][0]))
+          msg("%s: %s: loop count out of range\n", token[0], token[1]);
+        else
+          msg("%s: %s: numeric argument required\n", token[0], token[1]);
+        status = 1;
+        break;
+      }
+      case OP_HALT:
+        goto done;
+    }
+
+    setstatus(status);
+  }
+
+  status = 128 + SIGINT;
+
+done:
+  while (nframes > base)
+    (void)popframe();
+  setstatus(status);
+  free_chunk(c);
+  return status;
+}
+
+/* Execute compiled command line. Returns status of the last command. */
+int run_chunk(chunk_t *c) {
+  return exec(c);
+}
+
+/* Call function with arguments given by argv[1..]. */
+int callfunc(chunk_t *body, char **argv) {
+  if (depth == MAXDEPTH) {
+    msg("%s: maximum function nesting level exceeded\n", argv[0]);
+    return 1;
+  }
+
+  depth++;
+  pushargs(argv + 1);
+  int status = exec(body);
+  popargs();
+  depth--;
+  return status;
+}